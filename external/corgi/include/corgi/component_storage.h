@@ -0,0 +1,382 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CORGI_COMPONENT_STORAGE_H_
+#define CORGI_COMPONENT_STORAGE_H_
+
+#include <stddef.h>
+#include <iterator>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "corgi/entity_common.h"
+
+namespace corgi {
+
+/// @file
+/// @addtogroup corgi_component
+/// @{
+///
+/// @class AoSStorage
+///
+/// @brief The default storage for a System's data:  one array of
+/// {Entity, T} pairs.  (Array-of-structs.)
+///
+/// Every storage type offers the same small interface, which is all that
+/// System<T> uses.  Data is handed out as a Pointer, which for AoSStorage
+/// is just T*.
+///
+/// @tparam T The System's data type.
+template <typename T>
+class AoSStorage {
+ public:
+  /// @struct Item
+  /// @brief A structure of data that is associated with each Entity.
+  ///
+  /// It contains the template struct, as well as a pointer back to the
+  /// Entity that owns this data.
+  struct Item {
+    /// @brief The default constructor for an empty Item.
+    Item() {}
+
+    /// @var entity
+    ///
+    /// @brief The Entity associated with this data.
+    Entity entity;
+
+    /// @var data
+    ///
+    /// @brief The data to associate with the Entity.
+    T data;
+
+    /// @brief Construct a new Item from an existing Item.
+    ///
+    /// @param[in] src An existing Item whose data should be moved into the
+    /// new Item.
+    Item(Item&& src) {
+      entity = std::move(src.entity);
+      data = std::move(src.data);
+    }
+
+    /// @brief Move a referenced Item into this Item.
+    ///
+    /// @param[in] src A referenced Item to be moved into this Item.
+    Item& operator=(Item&& src) {
+      entity = std::move(src.entity);
+      data = std::move(src.data);
+      return *this;
+    }
+
+   private:
+    Item(const Item&);
+    Item& operator=(const Item&);
+  };
+
+  /// @brief How data is handed out.
+  typedef T* Pointer;
+  typedef const T* ConstPointer;
+  typedef typename std::vector<Item>::iterator iterator;
+
+  size_t size() const { return items_.size(); }
+  bool empty() const { return items_.empty(); }
+  Entity entity(size_t index) const { return items_[index].entity; }
+  Pointer Get(size_t index) { return &items_[index].data; }
+  ConstPointer Get(size_t index) const { return &items_[index].data; }
+  void* GetAsVoid(size_t index) { return &items_[index].data; }
+
+  /// @brief Appends a default-constructed T for an Entity.
+  void PushBack(Entity entity) {
+    items_.push_back(Item());
+    items_.back().entity = entity;
+  }
+
+  /// @brief Removes an element by moving the last one into its place.
+  void SwapRemove(size_t index) {
+    if (index != items_.size() - 1) items_[index] = std::move(items_.back());
+    items_.pop_back();
+  }
+
+  /// @brief Moves every element of other onto the end, as one block, and
+  /// empties other.
+  void Append(AoSStorage& other) {
+    items_.insert(items_.end(), std::make_move_iterator(other.items_.begin()),
+                  std::make_move_iterator(other.items_.end()));
+    other.items_.clear();
+  }
+
+  void clear() { items_.clear(); }
+  iterator begin() { return items_.begin(); }
+  iterator end() { return items_.end(); }
+
+ private:
+  std::vector<Item> items_;
+};
+
+/// @struct SoAField
+///
+/// @brief Names one field of T, for SoAColumns.
+///
+/// @tparam T The data type.
+/// @tparam FieldType The field's type.
+/// @tparam Member The field.
+template <typename T, typename FieldType, FieldType T::*Member>
+struct SoAField {
+  typedef FieldType type;
+  static const FieldType& From(const T& value) { return value.*Member; }
+};
+
+/// @class SoAColumns
+///
+/// @brief A set of arrays, one per listed field of T, all the same length.
+/// (Struct-of-arrays.)
+///
+/// Loops that only touch a few fields can stream through just those
+/// arrays, instead of pulling every whole struct through the cache.
+///
+/// @tparam T The data type.
+/// @tparam Fields One SoAField per field to store.  Fields of T that
+/// aren't listed aren't stored at all.
+template <typename T, typename... Fields>
+class SoAColumns {
+ public:
+  /// @brief The type of the I'th field.
+  template <size_t I>
+  using FieldType =
+      typename std::tuple_element<I, std::tuple<Fields...>>::type::type;
+
+  /// @brief Returns the I'th field's array.
+  template <size_t I>
+  FieldType<I>* Column() {
+    return std::get<I>(columns_).data();
+  }
+
+  size_t size() const { return std::get<0>(columns_).size(); }
+
+  /// @brief Appends one element, copying each field out of value.
+  void PushBack(const T& value) {
+    PushBack(value, std::index_sequence_for<Fields...>());
+  }
+
+  /// @brief Removes an element by moving the last one into its place.
+  void SwapRemove(size_t index) {
+    SwapRemove(index, std::index_sequence_for<Fields...>());
+  }
+
+  /// @brief Moves every element of other onto the end, and empties other.
+  void Append(SoAColumns& other) {
+    Append(other, std::index_sequence_for<Fields...>());
+  }
+
+  void clear() { clear(std::index_sequence_for<Fields...>()); }
+
+ private:
+  template <size_t... I>
+  void PushBack(const T& value, std::index_sequence<I...>) {
+    int expand[] = {(std::get<I>(columns_).push_back(
+        std::tuple_element<I, std::tuple<Fields...>>::type::From(value)), 0)...};
+    (void)expand;
+  }
+
+  template <size_t... I>
+  void SwapRemove(size_t index, std::index_sequence<I...>) {
+    int expand[] = {(SwapRemove(&std::get<I>(columns_), index), 0)...};
+    (void)expand;
+  }
+
+  template <typename U>
+  static void SwapRemove(std::vector<U>* column, size_t index) {
+    if (index != column->size() - 1) (*column)[index] = std::move(column->back());
+    column->pop_back();
+  }
+
+  template <size_t... I>
+  void Append(SoAColumns& other, std::index_sequence<I...>) {
+    int expand[] = {(std::get<I>(columns_).insert(
+        std::get<I>(columns_).end(),
+        std::make_move_iterator(std::get<I>(other.columns_).begin()),
+        std::make_move_iterator(std::get<I>(other.columns_).end())), 0)...};
+    (void)expand;
+    other.clear();
+  }
+
+  template <size_t... I>
+  void clear(std::index_sequence<I...>) {
+    int expand[] = {(std::get<I>(columns_).clear(), 0)...};
+    (void)expand;
+  }
+
+  std::tuple<std::vector<typename Fields::type>...> columns_;
+};
+
+/// @class SoAPointer
+///
+/// @brief Points at one element of an SoAColumns.  This is what Data<T>()
+/// returns for a type with SoA storage.
+///
+/// It behaves like a T*:  it can be null, and p->field reaches the field,
+/// through a Reference built on the fly.  So Data<T>(entity)->velocity and
+/// the like keep working, but code that spells out T* has to say auto (or
+/// System<T>::Pointer) instead.
+///
+/// @note Like a T*, it is invalidated when the System's storage is
+/// reshuffled.  (See System::storage_version.)
+///
+/// @tparam Columns The SoAColumns type.
+/// @tparam Reference A struct of references to one element's fields,
+/// constructible from (Columns&, size_t), with an operator-> that returns
+/// itself.
+template <typename Columns, typename Reference>
+class SoAPointer {
+ public:
+  SoAPointer() : columns_(nullptr), index_(0) {}
+  SoAPointer(std::nullptr_t) : columns_(nullptr), index_(0) {}
+  SoAPointer(Columns* columns, size_t index)
+      : columns_(columns), index_(index) {}
+
+  Reference operator->() const { return Reference(*columns_, index_); }
+  Reference operator*() const { return Reference(*columns_, index_); }
+
+  explicit operator bool() const { return columns_ != nullptr; }
+  bool operator==(std::nullptr_t) const { return columns_ == nullptr; }
+  bool operator!=(std::nullptr_t) const { return columns_ != nullptr; }
+
+  /// @brief The element's index in the columns.
+  size_t index() const { return index_; }
+
+ private:
+  Columns* columns_;
+  size_t index_;
+};
+
+/// @class SoAStorage
+///
+/// @brief Struct-of-arrays storage for a System's data:  the Entities in
+/// one array, and each field of T in an array of its own.  Select it for a
+/// data type with CORGI_SOA_STORAGE.
+///
+/// @tparam T The System's data type.  New elements are copied from a
+/// default-constructed T.
+/// @tparam Columns An SoAColumns for T.
+/// @tparam Reference See SoAPointer.
+template <typename T, typename Columns, typename Reference>
+class SoAStorage {
+ public:
+  typedef SoAPointer<Columns, Reference> Pointer;
+  typedef Pointer ConstPointer;
+
+  /// @brief What an iterator points at.  (Mirrors AoSStorage::Item.)
+  struct Item {
+    Entity entity;
+    Pointer data;
+    const Item* operator->() const { return this; }
+  };
+
+  /// @brief A forward iterator over the Entities and their data.
+  class iterator {
+   public:
+    iterator(SoAStorage* storage, size_t index)
+        : storage_(storage), index_(index) {}
+    Item operator*() const {
+      Item item = {storage_->entities_[index_], storage_->Get(index_)};
+      return item;
+    }
+    Item operator->() const { return **this; }
+    iterator& operator++() {
+      index_++;
+      return *this;
+    }
+    bool operator==(const iterator& other) const {
+      return index_ == other.index_;
+    }
+    bool operator!=(const iterator& other) const {
+      return index_ != other.index_;
+    }
+
+   private:
+    SoAStorage* storage_;
+    size_t index_;
+  };
+
+  size_t size() const { return entities_.size(); }
+  bool empty() const { return entities_.empty(); }
+  Entity entity(size_t index) const { return entities_[index]; }
+  Pointer Get(size_t index) { return Pointer(&columns_, index); }
+  ConstPointer Get(size_t index) const {
+    return Pointer(const_cast<Columns*>(&columns_), index);
+  }
+  // There's no single T in memory to point at.
+  void* GetAsVoid(size_t /*index*/) { return nullptr; }
+
+  /// @brief The columns themselves, for streaming passes over a field.
+  Columns* columns() { return &columns_; }
+
+  void PushBack(Entity entity) {
+    entities_.push_back(entity);
+    columns_.PushBack(T());
+  }
+
+  void SwapRemove(size_t index) {
+    if (index != entities_.size() - 1) entities_[index] = entities_.back();
+    entities_.pop_back();
+    columns_.SwapRemove(index);
+  }
+
+  void Append(SoAStorage& other) {
+    entities_.insert(entities_.end(), other.entities_.begin(),
+                     other.entities_.end());
+    other.entities_.clear();
+    columns_.Append(other.columns_);
+  }
+
+  void clear() {
+    entities_.clear();
+    columns_.clear();
+  }
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, entities_.size()); }
+
+ private:
+  std::vector<Entity> entities_;
+  Columns columns_;
+};
+
+/// @struct ComponentStorage
+///
+/// @brief Picks the storage a System<T> uses.  AoSStorage unless the data
+/// type was given another with CORGI_SOA_STORAGE.
+template <typename T>
+struct ComponentStorage {
+  typedef AoSStorage<T> type;
+};
+
+/// @def CORGI_SOA_STORAGE
+///
+/// @brief Stores a data type struct-of-arrays.  Must appear before the
+/// System for the type is declared, in the same header.
+///
+/// @param DataType The System's data type.
+/// @param ColumnsType An SoAColumns for it.
+/// @param ReferenceType See SoAPointer.
+#define CORGI_SOA_STORAGE(DataType, ColumnsType, ReferenceType)     \
+  namespace corgi {                                                  \
+  template <>                                                        \
+  struct ComponentStorage<DataType> {                                \
+    typedef SoAStorage<DataType, ColumnsType, ReferenceType> type;   \
+  };                                                                 \
+  }
+/// @}
+
+}  // corgi
+
+#endif  // CORGI_COMPONENT_STORAGE_H_
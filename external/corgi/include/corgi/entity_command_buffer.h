@@ -0,0 +1,192 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CORGI_ENTITY_COMMAND_BUFFER_H_
+#define CORGI_ENTITY_COMMAND_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+#include "corgi/entity_common.h"
+#include "corgi/system_id_lookup.h"
+
+namespace corgi {
+
+class EntityManager;
+
+/// @file
+/// @addtogroup corgi_entity_manager
+/// @{
+///
+/// @class EntityCommandBuffer
+///
+/// @brief Records entity creation, deletion and component adds made while
+/// systems are updating, so that they can be applied later, on the main
+/// thread.
+///
+/// Every job pool thread has its own buffer, (see EntityManager::commands)
+/// so recording never takes a lock.  At the end of UpdateSystems, the
+/// EntityManager plays every buffer back before PostUpdate.  Commands are
+/// grouped by the system that recorded them, and played back in SystemId
+/// order, (and in the order they were recorded, within a system) so the
+/// result doesn't depend on which thread happened to run what.
+///
+/// A new entity doesn't exist until playback, so there is no handle to
+/// hand out when it is recorded.  Instead, CreateEntity takes a function
+/// that sets the entity up once it does exist:
+///
+/// ~~~{.cpp}
+///   vec3 position = Data<TransformData>(ship)->position;
+///   entity_manager_->commands()->CreateEntity(
+///       [this, position](corgi::Entity exhaust) {
+///     entity_manager_->AddComponent<SpriteSystem>(exhaust);
+///     Data<TransformData>(exhaust)->position = position;
+///   });
+/// ~~~
+///
+/// The function runs on the main thread with no systems updating, so it may
+/// do anything, but anything it reads from other entities is read at
+/// playback, not when it was recorded.  Copy what you need into the
+/// capture instead.
+class EntityCommandBuffer {
+ public:
+  /// @brief Creates an empty buffer.
+  ///
+  /// @param[in] entity_manager The EntityManager to play commands back into.
+  explicit EntityCommandBuffer(EntityManager* entity_manager);
+
+  ~EntityCommandBuffer();
+
+  /// @brief Records the creation of a new Entity.
+  ///
+  /// @param[in] init Called as init(Entity) on playback, with the newly
+  /// allocated Entity.  Copied into the buffer.
+  template <typename Function>
+  void CreateEntity(const Function& init) {
+    void* memory = Allocate(sizeof(InitializerImpl<Function>),
+                            alignof(InitializerImpl<Function>));
+    Initializer* initializer = new (memory) InitializerImpl<Function>(init);
+    Record(kCreateEntity, kInvalidEntityId, kInvalidSystem, initializer);
+  }
+
+  /// @brief Records adding an existing Entity to a System.  Skipped on
+  /// playback if the Entity has been deleted by then.
+  ///
+  /// @tparam T The System (or its data type) to add the Entity to.
+  template <typename T>
+  void AddComponent(Entity entity) {
+    AddComponent(entity, SystemIdLookup<T>::system_id);
+  }
+
+  /// @brief Records adding an existing Entity to a System, by id.
+  void AddComponent(Entity entity, SystemId system_id) {
+    Record(kAddComponent, entity, system_id, nullptr);
+  }
+
+  /// @brief Marks an Entity for deletion, and records it, so that it is
+  /// deleted at the end of the frame.
+  ///
+  /// The mark is set immediately, so IsEntityMarkedForDeletion sees it
+  /// straight away, from any thread.
+  void DeleteEntity(Entity entity);
+
+  /// @brief True if nothing has been recorded since the last playback.
+  bool empty() const { return commands_.empty(); }
+
+ private:
+  friend class EntityManager;
+
+  enum CommandType {
+    kCreateEntity,
+    kAddComponent,
+    kDeleteEntity
+  };
+
+  struct Initializer {
+    virtual ~Initializer() {}
+    virtual void Run(Entity entity) = 0;
+  };
+
+  template <typename Function>
+  struct InitializerImpl : public Initializer {
+    explicit InitializerImpl(const Function& function) : function(function) {}
+    virtual void Run(Entity entity) { function(entity); }
+    Function function;
+  };
+
+  struct Command {
+    CommandType type;
+    Entity entity;
+    SystemId system_id;
+    Initializer* initializer;
+  };
+
+  // A run of commands, all recorded by the same system.
+  struct Segment {
+    SystemId system_id;
+    size_t begin;
+    size_t end;
+  };
+
+  // Block size for the initializer arena.  Bigger initializers get a block
+  // to themselves.
+  static const size_t kBlockSize = 16 * 1024;
+
+  void Record(CommandType type, Entity entity, SystemId system_id,
+              Initializer* initializer) {
+    Command command = {type, entity, system_id, initializer};
+    commands_.push_back(command);
+  }
+
+  void* Allocate(size_t size, size_t alignment);
+
+  // Called by the EntityManager around each system update on this buffer's
+  // thread.  Systems can nest, (a thread waiting inside one system's update
+  // may pick up another's job) so BeginSystem returns the system that was
+  // recording before, for EndSystem to resume.
+  SystemId BeginSystem(SystemId system_id);
+  void EndSystem(SystemId resumed_system_id);
+
+  // Closes the open segment and appends every non-empty one to segments.
+  void CloseSegments(std::vector<std::pair<const EntityCommandBuffer*,
+                                           Segment>>* segments);
+
+  // Applies one segment's commands.
+  void Playback(const Segment& segment) const;
+
+  // Destroys the initializers and empties the buffer, keeping its memory.
+  void Reset();
+
+  EntityManager* entity_manager_;
+  std::vector<Command> commands_;
+  std::vector<Segment> segments_;
+  SystemId current_system_;
+  size_t segment_begin_;
+
+  std::vector<std::unique_ptr<uint8_t[]>> blocks_;
+  std::vector<std::unique_ptr<uint8_t[]>> large_blocks_;
+  size_t block_index_;
+  size_t block_used_;
+
+  EntityCommandBuffer(const EntityCommandBuffer&);
+  EntityCommandBuffer& operator=(const EntityCommandBuffer&);
+};
+/// @}
+
+}  // corgi
+
+#endif  // CORGI_ENTITY_COMMAND_BUFFER_H_
@@ -53,8 +53,14 @@ typedef double WorldTime;
 /// @typedef ComponentIndex
 ///
 /// @brief A ComponentIndex is a value used to represent the location of a piece
-/// of ComponentData, normally inside of a VectorPool.
-typedef uint16_t ComponentIndex;
+/// of ComponentData inside of a System's dense component array.
+typedef uint32_t ComponentIndex;
+
+/// @var kInvalidComponentIndex
+///
+/// @brief A sentinel value to represent a missing component.
+const ComponentIndex kInvalidComponentIndex =
+    static_cast<ComponentIndex>(-1);
 
 /// @typedef EntityIdType
 ///
@@ -74,6 +80,49 @@ typedef EntityIdType Entity;
 /// uninitialized values, or to indicate a null return value.
 static const EntityIdType kInvalidEntityId = static_cast<EntityIdType>(-1);
 
+/// @var kEntityIndexBits
+///
+/// @brief An Entity is a generational handle:  the low kEntityIndexBits are
+/// a slot index, which the EntityManager recycles once the entity is
+/// deleted, and the remaining high bits are that slot's generation, which
+/// is bumped on every recycle.  Stale handles to a recycled slot therefore
+/// fail to compare equal to the live one.
+///
+/// @note Generations never wrap:  a slot whose generation runs out (after
+/// 4096 reuses) is retired for good, so a stale handle can't alias a live
+/// entity however long it's held.  Freed slots are also reused oldest
+/// first, so retirement takes a long time to set in.
+static const EntityIdType kEntityIndexBits = 20;
+static const EntityIdType kEntityIndexMask = (1u << kEntityIndexBits) - 1;
+static const EntityIdType kEntityGenerationBits = 32 - kEntityIndexBits;
+static const EntityIdType kEntityGenerationMask =
+    (1u << kEntityGenerationBits) - 1;
+
+/// @var kMaxEntities
+///
+/// @brief How many entity slots can ever be made:  the live entities, plus
+/// any slots retired after their generation ran out.  Making one more
+/// aborts, in every build.  (The last slot index is never handed out, so
+/// that no live entity can equal kInvalidEntityId.)
+static const EntityIdType kMaxEntities = kEntityIndexMask;
+
+/// @brief Returns the slot index part of an Entity handle.  Unique among
+/// live entities, and small, so it is suitable for indexing arrays.
+inline EntityIdType EntityIndex(EntityIdType entity) {
+  return entity & kEntityIndexMask;
+}
+
+/// @brief Returns the generation part of an Entity handle.
+inline EntityIdType EntityGeneration(EntityIdType entity) {
+  return entity >> kEntityIndexBits;
+}
+
+/// @brief Builds an Entity handle out of a slot index and a generation.
+inline EntityIdType MakeEntity(EntityIdType index, EntityIdType generation) {
+  return ((generation & kEntityGenerationMask) << kEntityIndexBits) |
+         (index & kEntityIndexMask);
+}
+
 /// @enum SystemDependency
 ///
 /// @brief `Various ways that systems depend on each other.
@@ -16,11 +16,19 @@
 #define CORGI_ENTITY_MANAGER_H_
 
 #include <SDL.h>
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <unordered_set>
-#include <map>
+#include <vector>
 #include "corgi/system_id_lookup.h"
 #include "corgi/system_interface.h"
+#include "corgi/component_storage.h"
+#include "corgi/entity_command_buffer.h"
 #include "corgi/entity_common.h"
+#include "corgi/job_pool.h"
+#include "corgi/scheduler_trace.h"
+#include "corgi/system_schedule.h"
 #include "corgi/version.h"
 #include <cassert>
 
@@ -49,6 +57,8 @@ namespace corgi {
 class EntityFactoryInterface;
 class SystemInterface;
 class EntityManager;
+template <typename T>
+class System;
 
 /// @class EntityManager
 /// @brief The EntityManager is the code that manages all
@@ -75,7 +85,8 @@ class EntityManager {
   /// @typedef EntityStorageContainer
   ///
   /// @brief This is used to track all Entities stored by the EntityManager.
-  typedef std::unordered_set<Entity> EntityStorageContainer;
+  /// Packed, in no particular order.
+  typedef std::vector<Entity> EntityStorageContainer;
 
   /// @brief Helper function for marshalling data from a System.
   ///
@@ -83,12 +94,14 @@ class EntityManager {
   ///
   /// @param[in] entity The Entity associated with the desired data.
   ///
-  /// @return Returns a pointer to the System data, or returns
+  /// @return Returns a pointer to the System data, (or whatever the
+  /// System's storage hands out instead, see System::Pointer) or returns
   /// a nullptr if no such data exists.
   template <typename T>
-  T* GetComponentData(const Entity entity) {
-    return static_cast<T*>(
-        GetComponentDataAsVoid(entity, SystemIdLookup<T>::system_id));
+  typename ComponentStorage<T>::type::Pointer GetComponentData(
+      const Entity entity) {
+    return static_cast<System<T>*>(GetSystem(SystemIdLookup<T>::system_id))
+        ->GetComponentData(entity);
   }
 
   /// @brief A helper function for marshalling data from a System.
@@ -100,9 +113,10 @@ class EntityManager {
   /// @return Returns a const pointer to the System data, or returns
   /// a nullptr if no such data exists.
   template <typename T>
-  const T* GetComponentData(const Entity entity) const {
-    return static_cast<const T*>(
-        GetComponentDataAsVoid(entity, SystemIdLookup<T>::system_id));
+  typename ComponentStorage<T>::type::ConstPointer GetComponentData(
+      const Entity entity) const {
+    return static_cast<const System<T>*>(
+        GetSystem(SystemIdLookup<T>::system_id))->GetComponentData(entity);
   }
 
   /// @brief A helper function for getting a particular System, given
@@ -205,6 +219,9 @@ class EntityManager {
 
   /// @brief Allocates a new Entity (that is registered with no Components).
   ///
+  /// @warning Not allowed while systems are updating.  Systems should
+  /// create entities through commands() instead.
+  ///
   /// @return Returns an Entity that points to the new Entity.
 	Entity AllocateNewEntity();
 
@@ -214,6 +231,9 @@ class EntityManager {
   /// @note Deletion is deferred until the end of the frame. If you want to
   /// delete something instantly, use DeleteEntityImmediately.
   ///
+  /// @note Safe to call from any system, on any thread.  While systems are
+  /// updating, this goes through the calling thread's commands().
+  ///
   /// @param[in] entity An Entity that points to the Entity that will be
   /// deleted at the end of the frame.
   void DeleteEntity(Entity entity);
@@ -222,12 +242,27 @@ class EntityManager {
   ///
   /// @note In general, you should use DeleteEntity (which defers deletion
   /// until the end of the update cycle) unless you have a very good reason
-  /// for doing so.
+  /// for doing so.  Not allowed while systems are updating.
   ///
   /// @param[in] entity An Entity that points to the Entity that will be
   /// immediately deleted.
   void DeleteEntityImmediately(Entity entity);
 
+  /// @brief Returns the calling thread's command buffer, for creating and
+  /// deleting entities, and adding components, from inside a system update.
+  /// The commands are applied at the end of UpdateSystems, before
+  /// PostUpdate.  (Or at the end of the next one, if recorded between
+  /// updates.)  See EntityCommandBuffer.
+  ///
+  /// @note Must be called from one of job_pool()'s threads, after
+  /// FinalizeSystemList.
+  EntityCommandBuffer* commands() {
+    int thread_index = job_pool_.CurrentThreadIndex();
+    assert(thread_index >= 0 &&
+           static_cast<size_t>(thread_index) < command_buffers_.size());
+    return command_buffers_[thread_index].get();
+  }
+
   /// @brief Registers a new System with the EntityManager.
   ///
   /// @tparam T The data type of the System that is being registered with the
@@ -269,6 +304,9 @@ class EntityManager {
   ///
   /// @param[in] delta_time A WorldTime that represents the timestep since
   /// the last update.
+  ///
+  /// @note Must be called on the thread that called FinalizeSystemList,
+  /// which is the job pool's thread 0.  Aborts, in every build, otherwise.
   void UpdateSystems(WorldTime delta_time);
 
   /// @brief Clears all data from all Components, empties the list
@@ -276,6 +314,16 @@ class EntityManager {
   /// This basically resets the EntityManager into its original state.
   void Clear();
 
+  /// @brief Returns the number of Entities currently tracked by the
+  /// EntityManager.  (Entities marked for deletion are still counted until
+  /// the end of the frame.)
+  size_t EntityCount() const { return entities_.size(); }
+
+  /// @brief Returns the number of entity slots ever allocated.  Every live
+  /// Entity's EntityIndex() is below this, so it is the size needed for a
+  /// dense per-entity array.
+  size_t EntitySlotCount() const { return entity_slots_.size(); }
+
   /// @brief Returns an iterator to the beginning of the active Entities.
   /// This is suitable for iterating over every active Entity.
   ///
@@ -337,7 +385,14 @@ class EntityManager {
 	/// @param[in] entity An entity to check for validity.
 	///
 	/// @return Returns True if the entity is valid, false otherwise.
-	bool IsEntityValid(Entity entity);
+	///
+	/// @note Handles to deleted entities are detected even after their slot
+	/// has been reused, since the slot's generation will have moved on.
+	bool IsEntityValid(Entity entity) const {
+		EntityIdType index = EntityIndex(entity);
+		return index < entity_slots_.size() &&
+		       entity_slots_[index].entity == entity;
+	}
 
 	/// @brief Checks if an entity is marked for deletion.  Marked entities
 	/// will be removed at the end of the next update.
@@ -346,7 +401,11 @@ class EntityManager {
 	///
 	/// @return Returns True if the entity is marked for deletion,
 	/// false otherwise.
-	bool IsEntityMarkedForDeletion(Entity entity);
+	bool IsEntityMarkedForDeletion(Entity entity) const {
+		return IsEntityValid(entity) &&
+		       entity_slots_[EntityIndex(entity)].marked_for_deletion.load(
+		           std::memory_order_relaxed);
+	}
 
   /// @brief Boolean that tracks whether the list of systems has been finalized.
   /// (via FinalizeSystemList)  Once FinalizeSystemList has been called, entities are
@@ -354,12 +413,30 @@ class EntityManager {
   bool is_system_list_final() { return is_system_list_final_; }
 
 	/// @brief Sets the max number of worker threads.  Must be called
-	/// before FinalizeSystemLists or else it is ignored.
+	/// before FinalizeSystemLists or else it is ignored.  Defaults to
+	/// JobPool::kDefaultWorkerCount, which is one per core, less one for the
+	/// main thread.
 	void set_max_worker_threads(int max_worker_threads) {
 		max_worker_threads_ = max_worker_threads;
 	}
 
+	/// @brief The pool that runs systems' updates.  It's started by
+	/// FinalizeSystemList, and other code is welcome to submit its own jobs
+	/// to it.  (Including from inside a system update.)
+	JobPool* job_pool() { return &job_pool_; }
+
+	/// @brief Attaches a SchedulerTrace, which records per-system and
+	/// per-thread timings for every UpdateSystems call while it is enabled.
+	/// Must be called before FinalizeSystemList, and the trace must outlive
+	/// the EntityManager.  Pass nullptr (the default) for no tracing.
+	void set_scheduler_trace(SchedulerTrace* scheduler_trace) {
+		assert(!is_system_list_final_);
+		scheduler_trace_ = scheduler_trace;
+	}
+
  private:
+  friend class EntityCommandBuffer;
+
   /// @brief Handles the majority of the work for registering a System (
   /// aside from some of the template stuff). In particular, it verifies that
   /// the request ID is not already in use, puts a pointer to the new System
@@ -410,56 +487,127 @@ class EntityManager {
   const void* GetComponentDataAsVoid(Entity entity,
                                      SystemId system_id) const;
 
-  /// @brief Searches through unupdated systems until it finds one that
-  /// is legal to begin updating.  (No unupdated dependencies, and no
-  /// read/write blocks.)
-  ///
-  /// @param[in] main_thread_only Specifies if you only want systems that can
-  /// be run from the main thread.  If set to true, FindSystemToUpdate will
-  /// only return systems that need to execute from the main thread.
-  ///
-  /// @return The system ID of the system to update.  Returns kInvalidSystem
-  /// if none could be found.
-  SystemId ClaimSystemToUpdate(bool main_thread_only);
+  /// @brief Claims every thread-safe system that is legal to begin
+  /// updating (no unupdated dependencies, and no read/write blocks) and
+  /// submits each one to the job pool.  See SystemSchedule.
+  void DispatchSystems();
 
-	// TODO(ccornell): write comments for these:
-	void MarkSystemAsUpdating(SystemId system);
-	void MarkSystemAsUpdated(SystemId system);
+	// Job entry point for a dispatched system.
+	static void SystemJob(void* data, int thread_index);
 
-	void WakeWorkerThreads();
+	// Runs a claimed system, marks it as updated, and dispatches whatever
+	// that unblocked.
+	void UpdateSystem(SystemId system_id, int thread_index);
 
-	static int EntityManagerWorkerThread(void*);
+	// Trace helpers.  When there's no trace attached (or it's disabled)
+	// these cost a branch.
+	uint64_t TraceTimestamp() const {
+		return (scheduler_trace_ && scheduler_trace_->enabled()) ?
+				SchedulerTrace::Now() : 0;
+	}
+	void TraceSpan(int thread_index, SchedulerTrace::SpanType type,
+			SystemId system_id, uint64_t start) {
+		if (scheduler_trace_) {
+			scheduler_trace_->RecordSpan(thread_index, type, system_id, start);
+		}
+	}
 
 	// Utility function for checking if we've updated everything yet.
-	bool IsSystemUpdateComplete();
+	bool IsSystemUpdateComplete() const { return schedule_.IsFrameComplete(); }
 
 
+	// Releases an entity's slot, so a later AllocateNewEntity can reuse it.
+	// The entity's System data should already be gone.
+	void FreeEntity(Entity entity);
+
+	// Sets an entity's deletion mark.  Safe from any thread.
+	void MarkEntityForDeletion(Entity entity) {
+		entity_slots_[EntityIndex(entity)].marked_for_deletion.store(
+				true, std::memory_order_relaxed);
+	}
+
+	// Applies every thread's recorded commands, grouped by the system that
+	// recorded them, in SystemId order.
+	void PlaybackCommands();
+
   /// @var entities_
   ///
   /// @brief Storage for all the Entities currently tracked by the
   /// EntityManager.
 	EntityStorageContainer entities_;
 
+	// One per entity slot ever handed out, indexed by EntityIndex().
+	struct EntitySlot {
+		EntitySlot()
+				: entity(kInvalidEntityId), generation(0), live_index(0),
+					marked_for_deletion(false) {}
+		// (Only copied while growing entity_slots_, which never happens while
+		// systems are updating.)
+		EntitySlot(const EntitySlot& other)
+				: entity(other.entity), generation(other.generation),
+					live_index(other.live_index),
+					marked_for_deletion(other.marked_for_deletion.load()) {}
+
+		// The live handle for this slot, or kInvalidEntityId if it's free.
+		Entity entity;
+		// The slot's generation.  Kept separately, since it has to survive
+		// while the slot is free.
+		EntityIdType generation;
+		// Where the entity sits in entities_, for swap-and-pop removal.
+		size_t live_index;
+		// Set by DeleteEntity, which can be called from any system's thread.
+		std::atomic<bool> marked_for_deletion;
+
+	 private:
+		EntitySlot& operator=(const EntitySlot&);
+	};
+
+  /// @var entity_slots_
+  ///
+  /// @brief Per-slot bookkeeping, so that validity checks are a single
+  /// array lookup.
+	std::vector<EntitySlot> entity_slots_;
+
+  /// @var free_entity_slots_
+  ///
+  /// @brief Slot indexes of deleted entities, waiting to be reused, oldest
+  /// first.
+	std::deque<EntityIdType> free_entity_slots_;
+
   /// @var systems_
   ///
   /// @brief All the Components that are tracked by the system, and are
   /// ready to have Entities added to them.
   std::vector<SystemInterface*> systems_;
 
-  // todo(ccornell): write comments for these:
-  std::unordered_set<SystemId> unupdated_systems_;
-  std::unordered_set<SystemId> updated_systems_;
-  std::unordered_set<SystemId> currently_updating_systems_;
-	std::map<SystemId, int> systems_being_written_to_;
-	std::map<SystemId, int> systems_being_read_from_;
+  /// @var schedule_
+  ///
+  /// @brief The system dependency graph, compiled by FinalizeSystemList.
+  /// Tracks which systems have run, are running, and can run next.
+	SystemSchedule schedule_;
 
 	// Thread stuff:
-	bool exit_worker_threads_;
-	SDL_mutex* bookkeeping_mutex_;
-	SDL_mutex* worker_thread_mutex_;
-	SDL_cond* worker_thread_cond_;
 	WorldTime delta_time_;
 	int max_worker_threads_;
+	JobPool job_pool_;
+
+	// One job per system, reused every frame.  (Each system is only ever
+	// dispatched once per frame.)
+	struct SystemJobData {
+		EntityManager* entity_manager;
+		SystemId system_id;
+		JobPool::Job job;
+	};
+	std::vector<SystemJobData> system_jobs_;
+
+	// One per job pool thread, indexed by thread index.
+	std::vector<std::unique_ptr<EntityCommandBuffer>> command_buffers_;
+
+	// True from the start of UpdateSystems until every system has finished,
+	// while structural changes have to go through command buffers.
+	bool systems_updating_;
+
+	SchedulerTrace* scheduler_trace_;
 
   /// @var entities_to_delete_
   ///
@@ -469,7 +617,11 @@ class EntityManager {
   /// @note These entities are deleted by a call to DeleteMarkedEntities().
   /// DeleteMarkedEntities should NOT be called called during any form of
   /// Entity update.
-	EntityStorageContainer entities_to_delete_;
+	std::vector<Entity> entities_to_delete_;
+
+	// The batch DeleteMarkedEntities is working on.  Kept around so its
+	// memory is reused.
+	std::vector<Entity> deleting_entities_;
 
   /// @var entity_factory_
   ///
@@ -485,8 +637,6 @@ class EntityManager {
   /// no longer allowed to change their dependencies.
   bool is_system_list_final_;
 
-	EntityIdType next_entity_id_;
-
   // Current version of the Corgi Entity Library.
   const CorgiVersion* version_;
 };
@@ -0,0 +1,260 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CORGI_JOB_POOL_H_
+#define CORGI_JOB_POOL_H_
+
+#include <SDL.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace corgi {
+
+class SchedulerTrace;
+
+/// @file
+/// @addtogroup corgi_entity
+/// @{
+///
+/// @typedef JobCounter
+///
+/// @brief Counts a group of outstanding jobs.  Submit increments it, and
+/// it is decremented as each job finishes, so JobPool::Wait can wait for
+/// the whole group.
+typedef std::atomic<int> JobCounter;
+
+/// @class JobPool
+///
+/// @brief A pool of worker threads that run small jobs, with work
+/// stealing.
+///
+/// Every pool thread (the thread that called Start is thread 0, and workers
+/// are 1..N) has its own deque of jobs.  A thread pushes and pops jobs at
+/// one end of its own deque without locking, and when it runs dry it steals
+/// from the other end of someone else's.  Jobs submitted from a thread
+/// outside the pool go through a locked queue instead.
+///
+/// Idle threads spin for a short while, then park.  Submitting a job wakes
+/// at most one parked thread, rather than all of them.
+///
+/// Jobs don't own anything:  the Job struct, and whatever its data points
+/// to, belong to the submitter, and must stay alive until the job has run.
+/// (Waiting on the job's counter is the usual way to know that.)
+class JobPool {
+ public:
+  /// @brief Pass to Start to get one worker per core, minus one for the
+  /// thread that calls Start.
+  static const int kDefaultWorkerCount = -1;
+
+  /// @brief The function a Job runs.
+  ///
+  /// @param[in] data The Job's data pointer.
+  /// @param[in] thread_index The pool thread it's running on.
+  typedef void (*JobFunction)(void* data, int thread_index);
+
+  /// @struct Job
+  ///
+  /// @brief One unit of work.
+  struct Job {
+    Job() : function(nullptr), data(nullptr), counter(nullptr) {}
+    Job(JobFunction function, void* data, JobCounter* counter)
+        : function(function), data(data), counter(counter) {}
+
+    JobFunction function;
+    void* data;
+    /// Optional.  Decremented when the job finishes.
+    JobCounter* counter;
+  };
+
+  JobPool();
+
+  /// @brief Stops and joins the worker threads.  Any jobs still queued are
+  /// dropped.
+  ~JobPool();
+
+  /// @brief Starts the worker threads.  The calling thread becomes thread
+  /// 0.  Does nothing if the pool is already running.
+  ///
+  /// @param[in] worker_count How many workers to start, or
+  /// kDefaultWorkerCount to size the pool from the number of cores.
+  void Start(int worker_count);
+
+  /// @brief Returns the worker count kDefaultWorkerCount stands for on
+  /// this machine.
+  static int DefaultWorkerCount();
+
+  /// @brief Returns the number of pool threads, including thread 0.
+  int thread_count() const { return static_cast<int>(queues_.size()); }
+
+  /// @brief Returns the calling thread's index in this pool, or -1 if it
+  /// isn't one of the pool's threads.
+  int CurrentThreadIndex() const;
+
+  /// @brief Queues a job.  Its counter, if it has one, is incremented
+  /// first.  If called from a pool thread, that thread will usually be the
+  /// one to run it, unless it gets stolen.
+  void Submit(Job* job);
+
+  /// @brief Runs one queued job on the calling thread, if there are any.
+  ///
+  /// @return Returns true if a job was run.
+  bool RunPendingJob();
+
+  /// @brief Runs jobs on the calling thread until the counter reaches zero.
+  /// Parks if there is nothing to help with.
+  void Wait(const JobCounter* counter);
+
+  /// @brief Returns a counter that moves whenever there might be new work,
+  /// or when WakeAll is called.  Read it before looking for work, and pass
+  /// it to Idle if none turns up.
+  uint32_t epoch() const { return epoch_.load(); }
+
+  /// @brief Spins, then parks, until epoch() moves on from seen_epoch.
+  /// Returns immediately if it already has.
+  void Idle(uint32_t seen_epoch);
+
+  /// @brief Bumps the epoch and wakes every parked thread.  For waking
+  /// threads that are waiting on something other than a job.  (e.g. the
+  /// main thread waiting for the last system of a frame.)
+  void WakeAll();
+
+  /// @brief Runs function(begin, end) over chunks of [0, count), spread
+  /// across the pool, and returns once every chunk has finished.  The
+  /// calling thread runs the first chunk itself, then helps with the rest.
+  ///
+  /// Chunks are never smaller than min_chunk_size, so small counts (or a
+  /// pool with no workers) just make one call on the calling thread.
+  ///
+  /// @param[in] count The number of items.
+  /// @param[in] min_chunk_size The fewest items worth sending to another
+  /// thread.
+  /// @param[in] function Called as function(size_t begin, size_t end).
+  /// Must be safe to call from several threads at once.
+  template <typename Function>
+  void ParallelFor(size_t count, size_t min_chunk_size,
+                   const Function& function) {
+    size_t max_chunks =
+        static_cast<size_t>(thread_count()) * kParallelForChunksPerThread;
+    if (max_chunks > kMaxParallelForChunks) max_chunks = kMaxParallelForChunks;
+    size_t chunk_count =
+        std::min(max_chunks, count / std::max<size_t>(min_chunk_size, 1));
+    if (chunk_count <= 1 || thread_count() <= 1) {
+      if (count > 0) function(0, count);
+      return;
+    }
+
+    ParallelForChunk<Function> chunks[kMaxParallelForChunks];
+    JobCounter counter(0);
+    for (size_t i = 0; i < chunk_count; i++) {
+      chunks[i].function = &function;
+      chunks[i].begin = count * i / chunk_count;
+      chunks[i].end = count * (i + 1) / chunk_count;
+      chunks[i].job = Job(ParallelForChunk<Function>::Run, &chunks[i],
+                          &counter);
+    }
+    // Submitted back to front, so that our own deque hands chunk 1 back to
+    // us first, and thieves start from the far end.
+    for (size_t i = chunk_count - 1; i > 0; i--) {
+      Submit(&chunks[i].job);
+    }
+    function(chunks[0].begin, chunks[0].end);
+    Wait(&counter);
+  }
+
+  /// @brief Records each thread's parked time as kWaitSpans.  Must be set
+  /// before Start, and outlive the pool.
+  void set_scheduler_trace(SchedulerTrace* scheduler_trace) {
+    scheduler_trace_ = scheduler_trace;
+  }
+
+ private:
+  // A Chase-Lev deque of Job pointers.  The owning thread pushes and pops
+  // at the bottom; anyone can steal from the top.
+  class JobDeque {
+   public:
+    static const int64_t kCapacity = 4096;
+
+    JobDeque() : top_(0), bottom_(0) {}
+
+    // Owner only.  Returns false if the deque is full.
+    bool Push(Job* job);
+    // Owner only.
+    Job* Pop();
+    // Any thread.
+    Job* Steal();
+
+   private:
+    static const int64_t kMask = kCapacity - 1;
+    std::atomic<int64_t> top_;
+    std::atomic<int64_t> bottom_;
+    std::atomic<Job*> buffer_[kCapacity];
+  };
+
+  struct WorkerThreadData {
+    JobPool* pool;
+    int thread_index;
+  };
+
+  // ParallelFor splits work into at most this many chunks per thread, (so
+  // that stealing can even out uneven chunks) and this many in total.
+  static const size_t kParallelForChunksPerThread = 4;
+  static const size_t kMaxParallelForChunks = 64;
+
+  template <typename Function>
+  struct ParallelForChunk {
+    static void Run(void* data, int /*thread_index*/) {
+      ParallelForChunk* chunk = static_cast<ParallelForChunk*>(data);
+      (*chunk->function)(chunk->begin, chunk->end);
+    }
+    const Function* function;
+    size_t begin;
+    size_t end;
+    Job job;
+  };
+
+  static int WorkerThread(void* data);
+
+  Job* FindJob(int thread_index);
+  void RunJob(Job* job, int thread_index);
+  void Notify();
+  void Park(uint32_t seen_epoch, int thread_index);
+
+  std::vector<std::unique_ptr<JobDeque>> queues_;
+
+  // For jobs submitted from outside the pool.
+  SDL_mutex* external_mutex_;
+  std::vector<Job*> external_jobs_;
+  std::atomic<int> external_job_count_;
+
+  SDL_mutex* park_mutex_;
+  SDL_cond* park_cond_;
+  std::atomic<uint32_t> epoch_;
+  std::atomic<int> parked_count_;
+  std::atomic<bool> exit_;
+
+  std::vector<SDL_Thread*> threads_;
+  std::vector<WorkerThreadData> thread_data_;
+  SchedulerTrace* scheduler_trace_;
+
+  JobPool(const JobPool&);
+  JobPool& operator=(const JobPool&);
+};
+/// @}
+
+}  // corgi
+
+#endif  // CORGI_JOB_POOL_H_
@@ -0,0 +1,189 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CORGI_QUERY_H_
+#define CORGI_QUERY_H_
+
+#include <stdint.h>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "corgi/entity_common.h"
+#include "corgi/entity_manager.h"
+#include "corgi/system.h"
+#include "corgi/system_id_lookup.h"
+
+namespace corgi {
+
+/// @file
+/// @addtogroup corgi_component
+/// @{
+///
+/// @class Query
+///
+/// @brief A join across several Systems:  every Entity that has data in all
+/// of them, with a pointer to each piece of data.
+///
+/// The join is resolved by Update(), which walks whichever System has the
+/// fewest entities and looks the rest up, then stores the results as one
+/// packed array of pointers per data type.  Inner loops can then run over
+/// those arrays directly, instead of doing a lookup per entity per type:
+///
+/// ~~~{.cpp}
+///   query_.Update(entity_manager_);
+///   TransformData* const* transforms = query_.Column<TransformData>();
+///   PhysicsData* const* physics = query_.Column<PhysicsData>();
+///   for (size_t i = 0; i < query_.size(); i++) {
+///     transforms[i]->position += ...;
+///   }
+/// ~~~
+///
+/// The results are cached, and only rebuilt when one of the Systems
+/// involved has reshuffled its storage.  (See System::storage_version.)
+///
+/// @note Only data that has been merged in by PostUpdate is joined.  Like
+/// begin() and end(), a Query doesn't see data added during the current
+/// frame until the next one.
+///
+/// @note Going through a Query skips the per-access dependency assert that
+/// System::Data does, so the calling System still needs to DependOn every
+/// type it names, for the scheduler's sake.
+///
+/// @tparam DataTypes The data types to join.  Each one must be stored by a
+/// registered System.
+template <typename... DataTypes>
+class Query {
+ public:
+  Query() {
+    for (size_t i = 0; i < kTypeCount; i++) {
+      versions_[i] = 0;
+    }
+  }
+
+  /// @brief Brings the join up to date.  Cheap if nothing has changed since
+  /// the last call.  Call this before reading the results each frame.
+  ///
+  /// @param[in] entity_manager The EntityManager the Systems belong to.
+  void Update(EntityManager* entity_manager) {
+    Update(entity_manager, std::index_sequence_for<DataTypes...>());
+  }
+
+  /// @brief Returns the number of Entities in the join.
+  size_t size() const { return entities_.size(); }
+
+  /// @brief Returns the i'th Entity in the join.
+  Entity entity(size_t i) const { return entities_[i]; }
+
+  /// @brief Returns the packed array of Entities in the join.
+  const Entity* Entities() const { return entities_.data(); }
+
+  /// @brief Returns the packed array of pointers to one data type, lined up
+  /// with Entities().  (T*, unless T's System stores it some other way.  See
+  /// System::Pointer.)
+  ///
+  /// @tparam T One of the query's DataTypes.
+  template <typename T>
+  typename System<T>::Pointer const* Column() const {
+    return std::get<TypeIndex<T, DataTypes...>::value>(columns_).data();
+  }
+
+  /// @brief Returns the i'th Entity's data, of one of the query's types.
+  template <typename T>
+  typename System<T>::Pointer Get(size_t i) const {
+    return Column<T>()[i];
+  }
+
+ private:
+  static const size_t kTypeCount = sizeof...(DataTypes);
+
+  // Finds T's position in a parameter pack.
+  template <typename T, typename... Rest>
+  struct TypeIndex;
+  template <typename T, typename... Rest>
+  struct TypeIndex<T, T, Rest...> {
+    static const size_t value = 0;
+  };
+  template <typename T, typename U, typename... Rest>
+  struct TypeIndex<T, U, Rest...> {
+    static const size_t value = 1 + TypeIndex<T, Rest...>::value;
+  };
+
+  template <typename T>
+  static System<T>* GetSystem(EntityManager* entity_manager) {
+    return static_cast<System<T>*>(
+        entity_manager->GetSystem(SystemIdLookup<T>::system_id));
+  }
+
+  template <size_t... I>
+  void Update(EntityManager* entity_manager, std::index_sequence<I...>) {
+    // Comparing the System pointers too means a fresh System, whose version
+    // happens to match, still forces a rebuild.
+    std::tuple<System<DataTypes>*...> systems(
+        GetSystem<DataTypes>(entity_manager)...);
+    uint32_t versions[kTypeCount] = {
+        std::get<I>(systems)->storage_version()...};
+    bool up_to_date = systems == systems_;
+    for (size_t i = 0; i < kTypeCount; i++) {
+      up_to_date = up_to_date && versions[i] == versions_[i];
+      versions_[i] = versions[i];
+    }
+    systems_ = systems;
+    if (up_to_date) return;
+
+    // Drive the join from the smallest System, so that the fewest lookups
+    // are wasted on entities that turn out not to match.
+    size_t counts[kTypeCount] = {std::get<I>(systems_)->ComponentCount()...};
+    size_t driver = 0;
+    for (size_t i = 1; i < kTypeCount; i++) {
+      if (counts[i] < counts[driver]) driver = i;
+    }
+
+    entities_.clear();
+    int expand[] = {(std::get<I>(columns_).clear(), 0)...};
+    int drive[] = {(I == driver ? (Drive<I>(), 0) : 0)...};
+    (void)expand;
+    (void)drive;
+  }
+
+  template <size_t Driver>
+  void Drive() {
+    auto system = std::get<Driver>(systems_);
+    for (auto itr = system->begin(); itr != system->end(); ++itr) {
+      Join(itr->entity, std::index_sequence_for<DataTypes...>());
+    }
+  }
+
+  template <size_t... I>
+  void Join(Entity entity, std::index_sequence<I...>) {
+    std::tuple<typename System<DataTypes>::Pointer...> row(
+        std::get<I>(systems_)->GetMergedComponentData(entity)...);
+    bool found[] = {std::get<I>(row) != nullptr...};
+    for (size_t i = 0; i < kTypeCount; i++) {
+      if (!found[i]) return;
+    }
+    entities_.push_back(entity);
+    int expand[] = {(std::get<I>(columns_).push_back(std::get<I>(row)), 0)...};
+    (void)expand;
+  }
+
+  std::tuple<System<DataTypes>*...> systems_;
+  uint32_t versions_[kTypeCount];
+  std::vector<Entity> entities_;
+  std::tuple<std::vector<typename System<DataTypes>::Pointer>...> columns_;
+};
+/// @}
+
+}  // corgi
+
+#endif  // CORGI_QUERY_H_
@@ -0,0 +1,174 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CORGI_SCHEDULER_TRACE_H_
+#define CORGI_SCHEDULER_TRACE_H_
+
+#include <SDL.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "corgi/entity_common.h"
+
+namespace corgi {
+
+class EntityManager;
+
+/// @file
+/// @addtogroup corgi_entity_manager
+/// @{
+///
+/// @class SchedulerTrace
+///
+/// @brief Records what the EntityManager's scheduler did each frame:
+/// which system ran on which thread, and how long each thread spent
+/// claiming work, running systems, marking them updated, and waiting.
+///
+/// Attach one with EntityManager::set_scheduler_trace before calling
+/// FinalizeSystemList.  Recording can then be switched on and off at any
+/// time with set_enabled.  While disabled (or when no trace is attached),
+/// the scheduler pays for a single branch per span.
+///
+/// Two views of the data are kept:
+///  * A rolling window of per-system run times, for PrintSystemTable.
+///  * Optionally, every span from a range of frames, for WriteChromeTrace.
+///    (Load the result in chrome://tracing.)
+class SchedulerTrace {
+ public:
+  /// @brief The different things a thread can be doing.
+  enum SpanType {
+    kClaimSpan = 0,
+    kRunSpan,
+    kMarkUpdatedSpan,
+    kWaitSpan,
+    kFrameSpan,
+    kSpanTypeCount
+  };
+
+  /// @brief Constructor.
+  ///
+  /// @param[in] rolling_window_frames How many frames of history to keep
+  /// for the per-system table.
+  explicit SchedulerTrace(int rolling_window_frames = 120);
+  ~SchedulerTrace();
+
+  /// @brief Turns recording on or off.  Safe to call between frames.
+  void set_enabled(bool enabled) { enabled_ = enabled; }
+  bool enabled() const { return enabled_; }
+
+  /// @brief Starts keeping every span, for up to max_frames frames, so
+  /// they can be written out with WriteChromeTrace.  Also enables the trace.
+  void StartCapture(int max_frames);
+
+  /// @brief Stops keeping spans.  Anything already captured is kept.
+  void StopCapture() { capture_frames_remaining_ = 0; }
+
+  /// @brief Writes everything captured so far as Chrome trace-event JSON.
+  ///
+  /// @return Returns false if the file couldn't be written.
+  bool WriteChromeTrace(const char* path) const;
+
+  /// @brief Prints min/avg/p99 run times per system over the rolling
+  /// window, followed by per-thread claim/run/mark/wait totals.
+  void PrintSystemTable(FILE* out) const;
+
+  /// @brief Returns a timestamp in the units spans are recorded in.
+  static uint64_t Now() { return SDL_GetPerformanceCounter(); }
+
+  // The functions below are called by the EntityManager.
+
+  /// @brief Sizes the per-thread buffers and grabs system names.  Called
+  /// once, from EntityManager::FinalizeSystemList.
+  void Init(EntityManager* entity_manager, int thread_count);
+
+  /// @brief Called at the start and end of EntityManager::UpdateSystems,
+  /// from the main thread.  EndFrame folds the frame's spans into the
+  /// rolling statistics (and the capture, if there is one).  Spans that
+  /// began before BeginFrame, like a wait that started in the last frame,
+  /// only count from BeginFrame on in the statistics.
+  void BeginFrame();
+  void EndFrame();
+
+  /// @brief Records one span.  Safe to call from any thread, as long as
+  /// each thread only ever uses its own thread_index.
+  ///
+  /// @param[in] thread_index 0 for the main thread, 1..N for workers.
+  /// @param[in] type What the thread was doing.
+  /// @param[in] system_id The system involved, or kInvalidSystem.
+  /// @param[in] start The value of Now() when the span began.
+  void RecordSpan(int thread_index, SpanType type, SystemId system_id,
+                  uint64_t start) {
+    // A zero start means the trace was off when the span began.
+    if (!enabled_ || start == 0) return;
+    RecordSpan(thread_index, type, system_id, start, Now());
+  }
+
+  void RecordSpan(int thread_index, SpanType type, SystemId system_id,
+                  uint64_t start, uint64_t end);
+
+ private:
+  struct Span {
+    uint64_t start;
+    uint64_t end;
+    SystemId system_id;
+    uint8_t type;
+    uint8_t thread_index;
+  };
+
+  // Each thread writes to its own buffer.  The mutex is only contended
+  // when the main thread collects the buffers at the end of a frame.
+  struct ThreadBuffer {
+    ThreadBuffer() : mutex(SDL_CreateMutex()) {}
+    ~ThreadBuffer() { SDL_DestroyMutex(mutex); }
+    SDL_mutex* mutex;
+    std::vector<Span> spans;
+  };
+
+  // Per-thread, per-span-type time, summed over the current frame.
+  struct ThreadTotals {
+    ThreadTotals() { for (int i = 0; i < kSpanTypeCount; i++) ticks[i] = 0; }
+    uint64_t ticks[kSpanTypeCount];
+  };
+
+  double TicksToMs(uint64_t ticks) const {
+    return static_cast<double>(ticks) * 1000.0 / ticks_per_second_;
+  }
+
+  // Read by every thread, for every span, while the main thread may be
+  // switching it.
+  std::atomic<bool> enabled_;
+  double ticks_per_second_;
+  int rolling_window_frames_;
+  int frames_recorded_;
+  uint64_t frame_start_;
+
+  std::vector<std::string> system_names_;
+  std::vector<ThreadBuffer*> thread_buffers_;
+
+  // Rolling window of run times:  system_run_ticks_[system][frame].
+  std::vector<std::vector<uint64_t>> system_run_ticks_;
+  // Rolling window of thread activity:  thread_totals_[thread][frame].
+  std::vector<std::vector<ThreadTotals>> thread_totals_;
+
+  int capture_frames_remaining_;
+  uint64_t capture_start_;
+  std::vector<Span> captured_spans_;
+  std::vector<Span> scratch_spans_;
+};
+/// @}
+
+}  // corgi
+
+#endif  // CORGI_SCHEDULER_TRACE_H_
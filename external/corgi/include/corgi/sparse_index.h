@@ -0,0 +1,121 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CORGI_SPARSE_INDEX_H_
+#define CORGI_SPARSE_INDEX_H_
+
+#include <assert.h>
+#include <vector>
+#include "corgi/entity_common.h"
+
+namespace corgi {
+
+/// @file
+/// @addtogroup corgi_component
+/// @{
+///
+/// @class SparseIndex
+///
+/// @brief Maps entity slot indexes to ComponentIndex values, for the sparse half
+/// of a sparse set.
+///
+/// Entries live in fixed-size pages, indexed directly by slot index, so a
+/// lookup is a shift, a mask and two loads - no hashing.  Pages are only
+/// allocated for id ranges that actually have entries, and are freed again
+/// once they empty out, so memory follows the live population rather than
+/// the highest id ever handed out.
+class SparseIndex {
+ public:
+  /// @brief How many slot indexes each page covers, as a power of two.
+  static const EntityIdType kPageBits = 10;
+  static const EntityIdType kPageSize = 1 << kPageBits;
+  static const EntityIdType kPageMask = kPageSize - 1;
+
+  SparseIndex() : count_(0) {}
+  ~SparseIndex() { Clear(); }
+
+  /// @brief Returns the index stored for an entity, or
+  /// kInvalidComponentIndex if there isn't one.
+  ComponentIndex Get(EntityIdType id) const {
+    size_t page = id >> kPageBits;
+    if (page >= pages_.size() || pages_[page] == nullptr) {
+      return kInvalidComponentIndex;
+    }
+    return pages_[page]->entries[id & kPageMask];
+  }
+
+  /// @brief Stores an index for an entity, overwriting any existing one.
+  void Set(EntityIdType id, ComponentIndex index) {
+    assert(index != kInvalidComponentIndex);
+    size_t page = id >> kPageBits;
+    if (page >= pages_.size()) pages_.resize(page + 1, nullptr);
+    if (pages_[page] == nullptr) pages_[page] = new Page();
+
+    ComponentIndex& entry = pages_[page]->entries[id & kPageMask];
+    if (entry == kInvalidComponentIndex) {
+      pages_[page]->count++;
+      count_++;
+    }
+    entry = index;
+  }
+
+  /// @brief Removes an entity's entry, if it has one.
+  void Erase(EntityIdType id) {
+    size_t page = id >> kPageBits;
+    if (page >= pages_.size() || pages_[page] == nullptr) return;
+
+    ComponentIndex& entry = pages_[page]->entries[id & kPageMask];
+    if (entry == kInvalidComponentIndex) return;
+    entry = kInvalidComponentIndex;
+    count_--;
+    if (--pages_[page]->count == 0) {
+      delete pages_[page];
+      pages_[page] = nullptr;
+    }
+  }
+
+  /// @brief Removes every entry and frees every page.
+  void Clear() {
+    for (size_t i = 0; i < pages_.size(); i++) {
+      delete pages_[i];
+    }
+    pages_.clear();
+    count_ = 0;
+  }
+
+  /// @brief Returns the number of entities with entries.
+  size_t size() const { return count_; }
+
+ private:
+  struct Page {
+    Page() : count(0) {
+      for (EntityIdType i = 0; i < kPageSize; i++) {
+        entries[i] = kInvalidComponentIndex;
+      }
+    }
+    ComponentIndex entries[kPageSize];
+    EntityIdType count;
+  };
+
+  SparseIndex(const SparseIndex&);
+  SparseIndex& operator=(const SparseIndex&);
+
+  std::vector<Page*> pages_;
+  size_t count_;
+};
+/// @}
+
+}  // corgi
+
+#endif  // CORGI_SPARSE_INDEX_H_
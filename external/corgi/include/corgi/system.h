@@ -17,6 +17,9 @@
 
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
+#include "corgi/component_storage.h"
+#include "corgi/sparse_index.h"
 #include "corgi/system_id_lookup.h"
 #include "corgi/system_interface.h"
 #include "corgi/entity_common.h"
@@ -41,58 +44,36 @@ namespace corgi {
 template <typename T>
 class System : public SystemInterface {
  public:
-  /// @struct ComponentData
-  /// @brief A structure of data that is associated with each Entity.
+  /// @typedef Storage
   ///
-  /// It contains the template struct, as well as a pointer back to the
-  /// Entity that owns this data.
-  struct ComponentData {
-    /// @brief The default constructor for an empty ComponentData.
-    ComponentData() {}
-
-    /// @var entity
-    ///
-    /// @brief The Entity associated with this data.
-    Entity entity;
-
-    /// @var data
-    ///
-    /// @brief The data to associate with the Entity.
-    T data;
-
-    /// @brief Construct a new ComponentData from an existing ComponentData.
-    ///
-    /// @param[in] src An existing ComponentData whose data should be moved
-    /// into the new ComponentData.
-    ComponentData(ComponentData&& src) {
-      entity = std::move(src.entity);
-      data = std::move(src.data);
-    }
+  /// @brief How the data is laid out in memory.  AoSStorage, unless the
+  /// data type picked another with CORGI_SOA_STORAGE.
+  typedef typename ComponentStorage<T>::type Storage;
 
-    /// @brief Move a referenced ComponentData into this ComponentData.
-    ///
-    /// Move operators are efficient since they allow referenced data to
-    /// be moved instead of copied.
-    ///
-    /// @param[in] src A referenced ComponentData to be moved into this
-    /// ComponentData.
-    ComponentData& operator=(ComponentData&& src) {
-      entity = std::move(src.entity);
-      data = std::move(src.data);
-      return *this;
-    }
+  /// @typedef Pointer
+  ///
+  /// @brief What the data is handed out as.  T* for AoSStorage.
+  typedef typename Storage::Pointer Pointer;
 
-   private:
-    ComponentData(const ComponentData&);
-    ComponentData& operator=(const ComponentData&);
-  };
+  /// @typedef ConstPointer
+  ///
+  /// @brief What the data is handed out as, from a const System.  const T*
+  /// for AoSStorage.
+  typedef typename Storage::ConstPointer ConstPointer;
+
+  /// @typedef ComponentData
+  ///
+  /// @brief A structure of data that is associated with each Entity.
+  ///
+  /// It contains the data, (as a Pointer, for storage that doesn't keep
+  /// whole T's) as well as the Entity that owns it.
+  typedef typename Storage::Item ComponentData;
 
   /// @typedef EntityIterator
   ///
   /// @brief An iterator to iterate through all of the Entities in the
   /// System.
-  //typedef typename VectorPool<ComponentData>::Iterator EntityIterator;
-	typedef typename std::vector<ComponentData>::iterator EntityIterator;
+  typedef typename Storage::iterator EntityIterator;
 
   /// @typedef value_type
   ///
@@ -100,7 +81,11 @@ class System : public SystemInterface {
   typedef T value_type;
 
   /// @brief Construct a System without an EntityManager.
-  System() : entity_manager_(nullptr), is_thread_safe_(false) {}
+  System()
+      : is_thread_safe_(false),
+        parallel_chunk_size_(0),
+        entity_manager_(nullptr),
+        storage_version_(0) {}
 
   /// @brief Destructor for a System.
   virtual ~System() {}
@@ -128,22 +113,23 @@ class System : public SystemInterface {
   /// @note If you have already registered for this System, this
   /// will just return a reference to the existing data and will not change
   /// anything.
-  T* AddEntity(Entity entity) {
+  Pointer AddEntity(Entity entity) {
     if (HasDataForEntity(entity)) {
       return GetComponentData(entity);
     }
 
     // No existing data, so we allocate some and return it:
-    // It gets added first to the recently_added_data map,
+    // It gets added first to the pending_data_ array,
     // so it doesn't interfere if it is being added iteration.
-    // It gets shuffled back in to the main pool during the
+    // It gets shuffled back in to the main array during the
     // postUpdate step.
-    recently_added_data_[entity] = ComponentData();
-    ComponentData* component_data = &recently_added_data_[entity];
-    component_data->entity = entity;
+    pending_data_.PushBack(entity);
+    component_index_lookup_.Set(EntityIndex(entity), kPendingIndexBit |
+        static_cast<ComponentIndex>(pending_data_.size() - 1));
     AddSystemDependencies(entity);
     InitEntity(entity);
-    return &(component_data->data);
+    // (Refetched, in case InitEntity added more data to this system.)
+    return GetComponentData(entity);
   }
 
   /// @brief Removes an Entity from the list of Entities.
@@ -161,25 +147,41 @@ class System : public SystemInterface {
     // if you want to double-check if data exists before removing it.
     assert(HasDataForEntity(entity));
 
-    if (component_index_lookup_.find(entity) !=
-        component_index_lookup_.end()) {
-      RemoveEntityInternal(entity);
-      ComponentIndex index = component_index_lookup_[entity];
+    RemoveEntityInternal(entity);
 
-      component_index_lookup_.erase(entity);
-      if (component_data_.size() > 1) {
-        component_data_[index] =
-            std::move(component_data_[component_data_.size() - 1]);
-        component_index_lookup_[component_data_[index].entity] = index;
-      }
-      component_data_.pop_back();
-    } else if (recently_added_data_.find(entity) !=
-        recently_added_data_.end()){
-      RemoveEntityInternal(entity);
-      recently_added_data_.erase(entity);
+    // Swap the last element into the hole, so the array stays packed.
+    ComponentIndex index = LookupIndex(entity);
+    ComponentIndex pending_bit = index & kPendingIndexBit;
+    Storage& storage = pending_bit ? pending_data_ : component_data_;
+    index &= ~kPendingIndexBit;
+
+    if (!pending_bit) storage_version_++;
+    component_index_lookup_.Erase(EntityIndex(entity));
+    if (index != storage.size() - 1) {
+      Entity moved = storage.entity(storage.size() - 1);
+      component_index_lookup_.Set(EntityIndex(moved), pending_bit | index);
     }
+    storage.SwapRemove(index);
   }
 
+  /// @brief Removes a batch of Entities at once.  Entities with no data in
+  /// this System are skipped.
+  ///
+  /// Each removal is still a swap with the last element, so the batch
+  /// costs O(k) for k removals, however big the System is.  Batching just
+  /// saves the EntityManager from asking every System about every Entity
+  /// through the interface, one at a time.
+  ///
+  /// @param[in] entities The Entities to remove.
+  /// @param[in] count The number of Entities.
+  virtual void RemoveEntities(const Entity* entities, size_t count) {
+    if (component_data_.empty() && pending_data_.empty()) return;
+    for (size_t i = 0; i < count; i++) {
+      if (LookupIndex(entities[i]) != kInvalidComponentIndex) {
+        RemoveEntity(entities[i]);
+      }
+    }
+  }
 
   /// @brief Gets an iterator that will iterate over every Entity associated
   /// with the System, starting from the beginning.
@@ -204,20 +206,48 @@ class System : public SystemInterface {
   /// any final updates needed.  (Usually where deferred adds and
   /// deletions take place.)
   virtual void PostUpdate() {
-    for (auto itr = recently_added_data_.begin();
-        itr != recently_added_data_.end(); ++itr) {
-      component_data_.push_back(std::move(itr->second));
-      ComponentIndex index = static_cast<ComponentIndex>(component_data_.size() - 1);
-      component_index_lookup_[itr->first] = index;
+    if (pending_data_.empty()) return;
+    storage_version_++;
+
+    // Appended as one block, (so at most one reallocation) then indexed.
+    size_t first = component_data_.size();
+    component_data_.Append(pending_data_);
+    for (size_t i = first; i < component_data_.size(); i++) {
+      component_index_lookup_.Set(EntityIndex(component_data_.entity(i)),
+                                  static_cast<ComponentIndex>(i));
     }
-    recently_added_data_.clear();
+  }
+
+  /// @brief Returns the number of Entities in the main array.  (i.e. the
+  /// ones that begin() to end() will visit.)
+  size_t ComponentCount() const { return component_data_.size(); }
+
+  /// @brief Returns a counter that changes whenever the main array is
+  /// reshuffled, by a removal or by PostUpdate merging in new data.
+  ///
+  /// Pointers into the main array stay good for as long as this doesn't
+  /// change, so anything caching them (like Query) can compare it to
+  /// decide when to refetch.
+  uint32_t storage_version() const { return storage_version_; }
+
+  /// @brief Like GetComponentData, but ignores data that was added this
+  /// frame and hasn't been merged in by PostUpdate yet.  The pointer
+  /// returned is good until storage_version() changes.
+  ///
+  /// @param[in] entity The Entity whose data should be returned.
+  ///
+  /// @return Returns the Entity's data, or nullptr if it has none in the
+  /// main array.
+  Pointer GetMergedComponentData(const Entity entity) {
+    ComponentIndex index = GetComponentDataIndex(entity);
+    if (index == kInvalidComponentIndex) return nullptr;
+    return component_data_.Get(index);
   }
 
   /// @brief Checks if this component contains any data associated with the
   /// supplied entity.
   virtual bool HasDataForEntity(const Entity entity) {
-    return (GetComponentDataIndex(entity) != kInvalidEntityId ||
-      recently_added_data_.find(entity) != recently_added_data_.end());
+    return LookupIndex(entity) != kInvalidComponentIndex;
   }
 
   /// @brief Gets the data for a given Entity as a void pointer.
@@ -233,9 +263,15 @@ class System : public SystemInterface {
   /// be returned.
   ///
   /// @return Returns the Entity's data as a void pointer, or returns a nullptr
-  /// if the data does not exist.
+  /// if the data does not exist.  (Or if the System's storage doesn't keep
+  /// whole T's, like SoAStorage.)
   virtual void* GetComponentDataAsVoid(const Entity entity) {
-    return GetComponentData(entity);
+    ComponentIndex index = LookupIndex(entity);
+    if (index == kInvalidComponentIndex) return nullptr;
+    if (index & kPendingIndexBit) {
+      return pending_data_.GetAsVoid(index & ~kPendingIndexBit);
+    }
+    return component_data_.GetAsVoid(index);
   }
 
   /// @brief Gets the data for a given Entity as a const void pointer.
@@ -254,7 +290,7 @@ class System : public SystemInterface {
   /// @return Returns the Entity's data as a const void pointer, or returns a
   /// nullptr if the data does not exist.
   virtual const void* GetComponentDataAsVoid(const Entity entity) const {
-    return GetComponentData(entity);
+    return const_cast<System*>(this)->GetComponentDataAsVoid(entity);
   }
 
   /// @brief Gets the data for a given Entity.
@@ -269,18 +305,13 @@ class System : public SystemInterface {
   /// @return Returns the Entity's data as a pointer of the data structure
   /// associated with the System data, or returns a nullptr if the data
   /// does not exist.
-  T* GetComponentData(const Entity entity) {
-		size_t data_index = GetComponentDataIndex(entity);
-		if (data_index == kInvalidEntityId) {
-      auto new_data = recently_added_data_.find(entity);
-      if (new_data != recently_added_data_.end()) {
-        return &(recently_added_data_[entity].data);
-      } else {
-        return nullptr;
-      }
-		}
-		ComponentData* element_data = &(component_data_[data_index]);
-		return (element_data != nullptr) ? &(element_data->data) : nullptr;
+  Pointer GetComponentData(const Entity entity) {
+    ComponentIndex index = LookupIndex(entity);
+    if (index == kInvalidComponentIndex) return nullptr;
+    if (index & kPendingIndexBit) {
+      return pending_data_.Get(index & ~kPendingIndexBit);
+    }
+    return component_data_.Get(index);
   }
 
   /// @brief Gets the data for a given Entity.
@@ -295,15 +326,18 @@ class System : public SystemInterface {
   /// @return Returns the Entity's data as a const pointer of the data
   /// structure associated with the System data, or returns a nullptr
   /// if the data does not exist.
-  const T* GetComponentData(const Entity entity) const {
+  ConstPointer GetComponentData(const Entity entity) const {
     return const_cast<System*>(this)->GetComponentData(entity);
   }
 
   /// @brief Clears all tracked System data.
   void virtual ClearComponentData() {
-		while (component_index_lookup_.size() > 0) {
-			RemoveEntity(component_data_[component_index_lookup_.begin()->second].entity);
-		}
+    while (!pending_data_.empty()) {
+      RemoveEntity(pending_data_.entity(pending_data_.size() - 1));
+    }
+    while (!component_data_.empty()) {
+      RemoveEntity(component_data_.entity(component_data_.size() - 1));
+    }
   }
 
   /// @brief A utility function for retrieving the System data for an
@@ -319,7 +353,7 @@ class System : public SystemInterface {
   /// Entity or returns null if the Entity is not registered with the
   /// System.
   template <typename ComponentDataType>
-  ComponentDataType* Data(const Entity entity) {
+  typename System<ComponentDataType>::Pointer Data(const Entity entity) {
 #ifdef CORGI_ENFORCE_SYSTEM_DEPENDENCIES
     // Verify that we're not asking for any data that we haven't already
     // declared a dependency on:
@@ -327,7 +361,7 @@ class System : public SystemInterface {
     assert(system_id == SystemIdLookup<T>::system_id ||
       access_dependencies_.find(system_id) != access_dependencies_.end());
 #endif  // CORGI_ENFORCE_SYSTEM_DEPENDENCIES
-    return entity_manager_->GetComponentData<ComponentDataType>(entity);
+    return DataSystem<ComponentDataType>()->GetComponentData(entity);
   }
 
 	virtual const char* Name() {
@@ -348,7 +382,7 @@ class System : public SystemInterface {
   template <typename ComponentDataType>
   bool IsRegisteredWithComponent(const Entity entity) {
     return entity_manager_
-        ->GetSystem(entity_manager_->GetComponentId<ComponentDataType>())
+        ->GetSystem(entity_manager_->GetSystemId<ComponentDataType>())
         ->HasDataForEntity(entity);
   }
 
@@ -365,16 +399,30 @@ class System : public SystemInterface {
   /// Entity or returns null if the Entity is not registered with the
   /// System.
   template <typename ComponentDataType>
-  ComponentDataType* Data(const Entity entity) const {
+  typename System<ComponentDataType>::Pointer Data(
+      const Entity entity) const {
 #ifdef CORGI_ENFORCE_SYSTEM_DEPENDENCIES
     // Verify that we're not asking for any data that we haven't already
     // declared a dependency on:
     SystemId component_id = SystemIdLookup<ComponentDataType>::system_id;
     assert(component_id == SystemIdLookup<T>::system_id ||
-      component_dependencies_.find(component_id)
-      != component_dependencies_.end());
+      access_dependencies_.find(component_id)
+      != access_dependencies_.end());
 #endif  // CORGI_ENFORCE_SYSTEM_DEPENDENCIES
-    return entity_manager_->GetComponentData<ComponentDataType>(entity);
+    return DataSystem<ComponentDataType>()->GetComponentData(entity);
+  }
+
+  /// @brief Returns the System that stores a given data type.
+  ///
+  /// Every System that stores ComponentDataType is a
+  /// System<ComponentDataType>, so Data() can call straight into it
+  /// without going through the virtual GetComponentDataAsVoid.
+  ///
+  /// @tparam ComponentDataType The data type stored by the System.
+  template <typename ComponentDataType>
+  System<ComponentDataType>* DataSystem() const {
+    return static_cast<System<ComponentDataType>*>(entity_manager_->GetSystem(
+        SystemIdLookup<ComponentDataType>::system_id));
   }
 
   /// @brief A utility function for retrieving a reference to a specific
@@ -544,6 +592,50 @@ class System : public SystemInterface {
     is_thread_safe_ = is_thread_safe;
   }
 
+  /// @brief Opts this system in to data-parallel updates, via ParallelFor
+  /// and ParallelForEachEntity.  0 (the default) opts out, and they just
+  /// run serially on the calling thread.
+  ///
+  /// @param[in] min_chunk_size The fewest entities worth handing to another
+  /// thread.
+  void SetParallelChunkSize(size_t min_chunk_size) {
+    parallel_chunk_size_ = min_chunk_size;
+  }
+
+  /// @brief Runs kernel(begin, end) over chunks of [0, count), across the
+  /// EntityManager's job pool, and returns once they've all finished.
+  ///
+  /// The chunks all run while this system holds its slot in the schedule,
+  /// so its declared dependencies still cover them:  the kernel may touch
+  /// anything the system itself may.  It must be safe to run on several
+  /// threads at once, though, so it should only touch the entities in its
+  /// own range, and shouldn't add or delete anything.
+  ///
+  /// @param[in] count The number of items.  (Often the size of a Query.)
+  /// @param[in] kernel Called as kernel(size_t begin, size_t end).
+  template <typename Kernel>
+  void ParallelFor(size_t count, const Kernel& kernel) {
+    if (parallel_chunk_size_ == 0) {
+      if (count > 0) kernel(0, count);
+      return;
+    }
+    entity_manager_->job_pool()->ParallelFor(count, parallel_chunk_size_,
+                                             kernel);
+  }
+
+  /// @brief Runs kernel(Entity, Pointer) for every entity in this system, split
+  /// into chunks across the job pool.  See ParallelFor for what the kernel
+  /// may do.
+  template <typename Kernel>
+  void ParallelForEachEntity(const Kernel& kernel) {
+    ParallelFor(component_data_.size(),
+                [this, &kernel](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        kernel(component_data_.entity(i), component_data_.Get(i));
+      }
+    });
+  }
+
 	  // todo: write desc
   virtual const std::unordered_map<SystemId, SystemAccessDependencyType>*
 	  AccessDependencies() {
@@ -581,31 +673,52 @@ class System : public SystemInterface {
   
   /// @brief : Designates whether or not this system is thread-safe.
   bool is_thread_safe_;
+  size_t parallel_chunk_size_;
 
  protected:
+  /// @brief Sparse index entries with this bit set point into
+  /// pending_data_, rather than component_data_.
+  static const ComponentIndex kPendingIndexBit = 0x80000000u;
+
   /// @brief Get the index of the System data for a given Entity.
   ///
   /// @param[in] entity An Entity reference to the Entity whose data
   /// index will be returned.
   ///
-  /// @return Returns a size_t corresponding to the index of the
-  /// System data, or kInvalidSystem if no data could be found.
-  size_t GetComponentDataIndex(const Entity entity) const {
-    auto result = component_index_lookup_.find(entity);
-    return (result != component_index_lookup_.end()) ? result->second
-                                                     : kInvalidEntityId;
+  /// @return Returns the index of the Entity's data in component_data_,
+  /// or kInvalidComponentIndex if it has none.  (Or if it was only added
+  /// this frame, and is still pending.)
+  ComponentIndex GetComponentDataIndex(const Entity entity) const {
+    ComponentIndex index = LookupIndex(entity);
+    return (index & kPendingIndexBit) ? kInvalidComponentIndex : index;
+  }
+
+  /// @brief Returns the raw sparse index entry for an Entity, (pending bit
+  /// and all) or kInvalidComponentIndex if it has no data here.
+  ///
+  /// The sparse index is keyed by slot index, so the handle stored with the
+  /// data is compared too.  That way a stale handle, whose slot has since
+  /// been recycled, doesn't find the new occupant's data.
+  ComponentIndex LookupIndex(const Entity entity) const {
+    ComponentIndex index = component_index_lookup_.Get(EntityIndex(entity));
+    if (index == kInvalidComponentIndex) return kInvalidComponentIndex;
+    Entity stored = (index & kPendingIndexBit)
+        ? pending_data_.entity(index & ~kPendingIndexBit)
+        : component_data_.entity(index);
+    return stored == entity ? index : kInvalidComponentIndex;
   }
 
   /// @var component_data_
   ///
-  /// @brief Storage for all of the data for the System.
-	std::vector<ComponentData> component_data_;
+  /// @brief Storage for all of the data for the System.  This is the dense
+  /// half of the sparse set:  always packed, in no particular order.
+	Storage component_data_;
 
-  /// @var recently_added_data_
+  /// @var pending_data_
   ///
   /// @brief Data that's been added this frame, but hasn't been
   /// moved into component_data_ yet.
-  std::unordered_map<Entity, ComponentData> recently_added_data_;
+  Storage pending_data_;
 
   /// @var entity_manager_
   ///
@@ -615,9 +728,15 @@ class System : public SystemInterface {
 
   /// @var component_index_lookup_
   ///
-  /// @brief A map for translating unique entity IDs into vector
-  /// indexes.
-  std::unordered_map<EntityIdType, ComponentIndex> component_index_lookup_;
+  /// @brief The sparse half of the sparse set, for translating entity slot
+  /// indexes into indexes into component_data_ (or pending_data_).
+  SparseIndex component_index_lookup_;
+
+  /// @var storage_version_
+  ///
+  /// @brief Bumped whenever component_data_ is reshuffled.  See
+  /// storage_version().
+  uint32_t storage_version_;
 };
 /// @}
 
@@ -68,6 +68,13 @@ public:
 	/// from this System.
 	virtual void RemoveEntity(Entity entity) = 0;
 
+	/// @brief Remove a batch of Entities from the System's list.  Entities
+	/// that aren't in this System are skipped.
+	///
+	/// @param[in] entities The Entities to remove.
+	/// @param[in] count The number of Entities.
+	virtual void RemoveEntities(const Entity* entities, size_t count) = 0;
+
   /// @brief Called at the end of each update frame, after all
   /// updates are completed.  A place where systems can perform
   /// any final updates needed.  (Usually where deferred adds and
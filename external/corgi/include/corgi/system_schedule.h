@@ -0,0 +1,146 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CORGI_SYSTEM_SCHEDULE_H_
+#define CORGI_SYSTEM_SCHEDULE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "corgi/entity_common.h"
+
+namespace corgi {
+
+class SystemInterface;
+
+/// @file
+/// @addtogroup corgi_entity
+/// @{
+///
+/// @class SystemSchedule
+///
+/// @brief The system dependency graph, compiled into a form that can be
+/// dispatched from several threads without locking.
+///
+/// Dependencies are fixed once the system list is finalized, so Build()
+/// works out everything up front:  each system's successors and number of
+/// predecessors, which other systems it conflicts with (because they touch
+/// the same data, and at least one of them writes it), and a priority
+/// order that favors the longest remaining chain.
+///
+/// Each frame, every system gets a counter of predecessors still to run.
+/// Finishing a system decrements its successors' counters, and any that hit
+/// zero become ready.  The ready and running sets live together in one
+/// atomic word, so claiming a system (ready, and no conflicting system
+/// running) is a single compare-and-swap.
+///
+/// @note A system implicitly writes its own data, so it conflicts with
+/// anything that declares access to it.
+class SystemSchedule {
+ public:
+  /// @brief The most systems a schedule can handle.  (One bit each for
+  /// ready and running, in a 64-bit word.)
+  static const size_t kMaxSystems = 32;
+
+  SystemSchedule();
+
+  /// @brief Compiles the dependency graph.  Asserts if there is a cycle.
+  /// Aborts, in every build, if there are more than kMaxSystems systems.
+  ///
+  /// @param[in] systems Every registered system, indexed by SystemId.
+  /// Their dependencies must already be declared.
+  void Build(const std::vector<SystemInterface*>& systems);
+
+  /// @brief Resets the per-frame counters, and marks every system with no
+  /// predecessors as ready.  Must not be called while a frame is running.
+  void BeginFrame();
+
+  /// @brief Claims the highest-priority system that is ready and doesn't
+  /// conflict with anything running.
+  ///
+  /// @param[in] thread_safe Whether to claim a thread-safe system, (which
+  /// can run anywhere) or one that has to run on the main thread.
+  ///
+  /// @return The claimed system, or kInvalidSystem if nothing is claimable
+  /// right now.
+  SystemId Claim(bool thread_safe);
+
+  /// @brief True if any system that has to run on the main thread is ready.
+  /// (Though it may still be blocked by a conflict.)
+  bool HasReadyMainThreadSystems() const {
+    return (state_.load() & kReadyMask & ~thread_safe_mask_) != 0;
+  }
+
+  /// @brief Marks a claimed system as finished, releasing its successors.
+  ///
+  /// @param[in] system_id The system, as returned by Claim.
+  /// @param[in] run_ticks How long it took to run.  Feeds the critical-path
+  /// estimate for later frames.
+  void Complete(SystemId system_id, uint64_t run_ticks);
+
+  /// @brief True once every system has completed this frame.
+  bool IsFrameComplete() const {
+    return completed_count_.load() == system_count_;
+  }
+
+  /// @brief A counter that moves whenever the set of claimable systems may
+  /// have grown.  Threads waiting for work can read it before trying to
+  /// claim, and only sleep if it hasn't moved since.
+  uint32_t epoch() const { return epoch_.load(); }
+
+  /// @brief The systems, highest priority first.  (As of the last
+  /// BeginFrame.)
+  const std::vector<SystemId>& priority_order() const {
+    return priority_order_;
+  }
+
+ private:
+  // Low half of state_ is the ready set, high half the running set.
+  static const uint64_t kReadyMask = (uint64_t(1) << kMaxSystems) - 1;
+  static uint64_t ReadyBit(SystemId id) { return uint64_t(1) << id; }
+  static uint64_t RunningBit(SystemId id) {
+    return uint64_t(1) << (id + kMaxSystems);
+  }
+
+  bool TryClaim(SystemId id);
+  void UpdatePriorities();
+
+  size_t system_count_;
+
+  // Static graph, from Build.
+  std::vector<std::vector<SystemId>> successors_;
+  std::vector<int> predecessor_count_;
+  std::vector<uint64_t> conflict_mask_;  // In running-bit positions.
+  std::vector<SystemId> topological_order_;
+  uint64_t initially_ready_;
+  uint64_t thread_safe_mask_;  // In ready-bit positions.
+
+  // Critical path estimates.  cost_ is a running average of each system's
+  // update time; priority_ is the cost of the longest chain starting there.
+  std::vector<double> cost_;
+  std::vector<double> priority_;
+  std::vector<SystemId> priority_order_;
+
+  // Per-frame state.
+  std::unique_ptr<std::atomic<int>[]> remaining_predecessors_;
+  std::atomic<uint64_t> state_;
+  std::atomic<size_t> completed_count_;
+  std::atomic<uint32_t> epoch_;
+};
+/// @}
+
+}  // corgi
+
+#endif  // CORGI_SYSTEM_SCHEDULE_H_
@@ -0,0 +1,124 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <assert.h>
+#include "corgi/entity_command_buffer.h"
+#include "corgi/entity_manager.h"
+
+namespace corgi {
+
+EntityCommandBuffer::EntityCommandBuffer(EntityManager* entity_manager)
+    : entity_manager_(entity_manager),
+      current_system_(kInvalidSystem),
+      segment_begin_(0),
+      block_index_(0),
+      block_used_(0) {}
+
+EntityCommandBuffer::~EntityCommandBuffer() { Reset(); }
+
+void EntityCommandBuffer::DeleteEntity(Entity entity) {
+  if (!entity_manager_->IsEntityValid(entity)) return;
+  entity_manager_->MarkEntityForDeletion(entity);
+  Record(kDeleteEntity, entity, kInvalidSystem, nullptr);
+}
+
+// Rounds a pointer up to a power-of-two alignment.
+static uint8_t* AlignPointer(uint8_t* pointer, size_t alignment) {
+  uintptr_t address = reinterpret_cast<uintptr_t>(pointer);
+  return pointer + (((address + alignment - 1) & ~(alignment - 1)) - address);
+}
+
+// A bump allocator over fixed-size blocks, which are kept between frames.
+// (Blocks never move, so initializers don't need to be movable.)
+void* EntityCommandBuffer::Allocate(size_t size, size_t alignment) {
+  assert((alignment & (alignment - 1)) == 0);
+  if (size + alignment > kBlockSize) {
+    large_blocks_.push_back(
+        std::unique_ptr<uint8_t[]>(new uint8_t[size + alignment]));
+    return AlignPointer(large_blocks_.back().get(), alignment);
+  }
+
+  if (block_index_ < blocks_.size()) {
+    uint8_t* block = blocks_[block_index_].get();
+    uint8_t* memory = AlignPointer(block + block_used_, alignment);
+    if (memory + size <= block + kBlockSize) {
+      block_used_ = (memory - block) + size;
+      return memory;
+    }
+    block_index_++;
+  }
+  if (block_index_ == blocks_.size()) {
+    blocks_.push_back(std::unique_ptr<uint8_t[]>(new uint8_t[kBlockSize]));
+  }
+  uint8_t* block = blocks_[block_index_].get();
+  uint8_t* memory = AlignPointer(block, alignment);
+  block_used_ = (memory - block) + size;
+  return memory;
+}
+
+SystemId EntityCommandBuffer::BeginSystem(SystemId system_id) {
+  SystemId previous_system = current_system_;
+  EndSystem(system_id);
+  return previous_system;
+}
+
+void EntityCommandBuffer::EndSystem(SystemId resumed_system_id) {
+  if (commands_.size() > segment_begin_) {
+    Segment segment = {current_system_, segment_begin_, commands_.size()};
+    segments_.push_back(segment);
+  }
+  current_system_ = resumed_system_id;
+  segment_begin_ = commands_.size();
+}
+
+void EntityCommandBuffer::CloseSegments(
+    std::vector<std::pair<const EntityCommandBuffer*, Segment>>* segments) {
+  EndSystem(current_system_);
+  for (size_t i = 0; i < segments_.size(); i++) {
+    segments->push_back(std::make_pair(this, segments_[i]));
+  }
+}
+
+void EntityCommandBuffer::Playback(const Segment& segment) const {
+  for (size_t i = segment.begin; i < segment.end; i++) {
+    const Command& command = commands_[i];
+    switch (command.type) {
+      case kCreateEntity:
+        command.initializer->Run(entity_manager_->AllocateNewEntity());
+        break;
+      case kAddComponent:
+        if (entity_manager_->IsEntityValid(command.entity)) {
+          entity_manager_->AddComponent(command.entity, command.system_id);
+        }
+        break;
+      case kDeleteEntity:
+        entity_manager_->entities_to_delete_.push_back(command.entity);
+        break;
+    }
+  }
+}
+
+void EntityCommandBuffer::Reset() {
+  for (size_t i = 0; i < commands_.size(); i++) {
+    if (commands_[i].initializer) commands_[i].initializer->~Initializer();
+  }
+  commands_.clear();
+  segments_.clear();
+  segment_begin_ = 0;
+  large_blocks_.clear();
+  block_index_ = 0;
+  block_used_ = 0;
+}
+
+}  // corgi
@@ -13,74 +13,133 @@
 // limitations under the License.
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
 #include "corgi/system_id_lookup.h"
 #include "corgi/entity_manager.h"
 #include "corgi/version.h"
 
 namespace corgi {
 
-#define DEFAULT_MAX_THREADS 3
-
 // The reference to the version string is important because it ensures that
 // the constant won't be stripped out by the compiler.
 EntityManager::EntityManager()
-    : entity_factory_(nullptr),
-      version_(&Version()),
-			exit_worker_threads_(false),
-			bookkeeping_mutex_(SDL_CreateMutex()),
-			worker_thread_mutex_(SDL_CreateMutex()),
-			worker_thread_cond_(SDL_CreateCond()),
-			max_worker_threads_(DEFAULT_MAX_THREADS - 1),
-			next_entity_id_(1) {}
-
-EntityManager::~EntityManager() {
-	SDL_DestroyMutex(bookkeeping_mutex_);
-	SDL_DestroyMutex(worker_thread_mutex_);
-	SDL_DestroyCond(worker_thread_cond_);
+    : max_worker_threads_(JobPool::kDefaultWorkerCount),
+      systems_updating_(false),
+      scheduler_trace_(nullptr),
+      entity_factory_(nullptr),
+      is_system_list_final_(false),
+      version_(&Version()) {}
+
+// The job pool's destructor joins the worker threads.
+EntityManager::~EntityManager() {}
+
+// Allocates a new entity and returns it.  Slots of deleted entities are
+// reused (least recently freed first, so each one's generation goes round
+// as slowly as it can) before any new ones are made.
+Entity EntityManager::AllocateNewEntity() {
+	// Systems have to go through commands() instead.
+	assert(!systems_updating_);
+	EntityIdType index;
+	if (!free_entity_slots_.empty()) {
+		index = free_entity_slots_.front();
+		free_entity_slots_.pop_front();
+	} else {
+		// Past this, the index would spill into the generation bits, and
+		// handles would silently alias.  So this can't just be an assert.
+		if (entity_slots_.size() >= kMaxEntities) {
+			fprintf(stderr, "corgi: %d entity slots in use or retired, but at "
+			        "most %d are supported.\n",
+			        static_cast<int>(entity_slots_.size()),
+			        static_cast<int>(kMaxEntities));
+			abort();
+		}
+		index = static_cast<EntityIdType>(entity_slots_.size());
+		entity_slots_.push_back(EntitySlot());
+	}
+	EntitySlot& slot = entity_slots_[index];
+	slot.entity = MakeEntity(index, slot.generation);
+	slot.live_index = entities_.size();
+	slot.marked_for_deletion = false;
+	entities_.push_back(slot.entity);
+	return slot.entity;
 }
 
-// Allocates a new entity and returns it
-Entity EntityManager::AllocateNewEntity() {
-	Entity result = next_entity_id_++;
-	// Fix for the (basically nonexistant) problem of our ID rolling over.
-	if (next_entity_id_ == kInvalidEntityId) next_entity_id_ = 0;
-	entities_.insert(result);
-	return result;
+void EntityManager::FreeEntity(Entity entity) {
+	EntitySlot& slot = entity_slots_[EntityIndex(entity)];
+
+	// Swap-and-pop it out of the live list.
+	Entity moved = entities_.back();
+	entities_[slot.live_index] = moved;
+	entity_slots_[EntityIndex(moved)].live_index = slot.live_index;
+	entities_.pop_back();
+
+	// Bumping the generation is what invalidates any outstanding handles.
+	// Once it's used them all up, the slot is retired rather than wrapping
+	// round, so a stale handle can never match a newer entity.
+	slot.entity = kInvalidEntityId;
+	slot.generation = (slot.generation + 1) & kEntityGenerationMask;
+	slot.marked_for_deletion = false;
+	if (slot.generation != 0) {
+		free_entity_slots_.push_back(EntityIndex(entity));
+	}
 }
 
 // Note: This function doesn't actually delete the entity immediately -
 // it just marks it for deletion, and it gets cleaned out at the end of the
 // next AdvanceFrame.
 void EntityManager::DeleteEntity(Entity entity) {
-	if (entities_to_delete_.find(entity) != entities_to_delete_.end()) {
-    // already marked for deletion.
+	if (systems_updating_) {
+		commands()->DeleteEntity(entity);
+		return;
+	}
+	if (!IsEntityValid(entity) || IsEntityMarkedForDeletion(entity)) {
+    // already deleted, or already marked for deletion.
     return;
   }
-  entities_to_delete_.insert(entity);
+	MarkEntityForDeletion(entity);
+  entities_to_delete_.push_back(entity);
 }
 
 // This deletes the entity instantly.  You should generally use the regular
 // DeleteEntity unless you have a particuarly good reason to need it instantly.
 void EntityManager::DeleteEntityImmediately(Entity entity) {
+	assert(!systems_updating_);
+	if (!IsEntityValid(entity)) return;
   RemoveAllSystems(entity);
-	entities_.erase(entity);
+	FreeEntity(entity);
 }
 
+// Deletes in batches:  each system removes the whole batch in one pass,
+// instead of every system being probed for every entity.
 void EntityManager::DeleteMarkedEntities() {
-  //for (size_t i = 0; i < entities_to_delete_.size(); i++) {
-	for (auto itr = entities_to_delete_.begin(); itr != entities_to_delete_.end(); ++itr) {
-    RemoveAllSystems(*itr);
-		entities_.erase(*itr);
-  }
-	entities_to_delete_.clear();
-}
-
-bool EntityManager::IsEntityValid(Entity entity) {
-	return entities_.find(entity) != entities_.end();
-}
+	while (!entities_to_delete_.empty()) {
+		// Swapped out, in case any CleanupEntity deletes more entities.  They
+		// go in the next batch.
+		deleting_entities_.swap(entities_to_delete_);
+
+		// Might have been deleted immediately since it was marked.  (Or be
+		// listed twice, which the systems and the free loop both skip.)
+		size_t count = 0;
+		for (size_t i = 0; i < deleting_entities_.size(); i++) {
+			if (IsEntityValid(deleting_entities_[i])) {
+				deleting_entities_[count++] = deleting_entities_[i];
+			}
+		}
 
-bool EntityManager::IsEntityMarkedForDeletion(Entity entity) {
-	return entities_to_delete_.find(entity) != entities_to_delete_.end();
+		for (size_t i = 0; i < systems_.size(); i++) {
+			if (systems_[i]) {
+				systems_[i]->RemoveEntities(deleting_entities_.data(), count);
+			}
+		}
+		for (size_t i = 0; i < count; i++) {
+			if (IsEntityValid(deleting_entities_[i])) {
+				FreeEntity(deleting_entities_[i]);
+			}
+		}
+		deleting_entities_.clear();
+	}
 }
 
 void EntityManager::RemoveAllSystems(Entity entity) {
@@ -113,14 +172,32 @@ void EntityManager::FinalizeSystemList() {
     if (systems_[i]) systems_[i]->DeclareDependencies();
 	}
   is_system_list_final_ = true;
-  //todo: validate dependencies, make sure none are circular, etc.
+
+  // Dependencies are fixed from here on, so compile them once.  (This also
+  // asserts that they aren't circular.)
+  schedule_.Build(systems_);
 
 
-	for (int i = 0; i < max_worker_threads_; i++) {
-		SDL_CreateThread(EntityManager::EntityManagerWorkerThread,
-			"WorkerThread", this);
+	int worker_count = max_worker_threads_ >= 0 ?
+			max_worker_threads_ : JobPool::DefaultWorkerCount();
+	if (scheduler_trace_) {
+		scheduler_trace_->Init(this, worker_count + 1);
+		job_pool_.set_scheduler_trace(scheduler_trace_);
+	}
 
+	system_jobs_.resize(systems_.size());
+	for (size_t i = 0; i < systems_.size(); i++) {
+		SystemJobData& system_job = system_jobs_[i];
+		system_job.entity_manager = this;
+		system_job.system_id = static_cast<SystemId>(i);
+		system_job.job = JobPool::Job(EntityManager::SystemJob, &system_job,
+				nullptr);
+	}
+	for (int i = 0; i < worker_count + 1; i++) {
+		command_buffers_.push_back(std::unique_ptr<EntityCommandBuffer>(
+				new EntityCommandBuffer(this)));
 	}
+	job_pool_.Start(worker_count);
 }
 
 void* EntityManager::GetComponentDataAsVoid(Entity entity,
@@ -140,59 +217,41 @@ const void* EntityManager::GetComponentDataAsVoid(
 void EntityManager::UpdateSystems(WorldTime delta_time) {
 	// Assert if you haven't finalized the system list.
 	assert(is_system_list_final_);
+	// Systems run inline here use this thread's command buffer and trace
+	// row, so it has to be the pool's thread 0.  Anywhere else, that index
+	// is -1, so this can't just be an assert.
+	int thread_index = job_pool_.CurrentThreadIndex();
+	if (thread_index != 0) {
+		fprintf(stderr, "corgi: UpdateSystems called on thread %d, not the "
+		        "thread that called FinalizeSystemList.\n", thread_index);
+		abort();
+	}
+
+	if (scheduler_trace_) scheduler_trace_->BeginFrame();
 
 	// save off the delta time, so that worker threads can see it.
 	delta_time_ = delta_time;
 
-	// The current-read/write status should be clear, but we'll double
-	// check because paranoia.
-	for (size_t i = 0; i < systems_.size(); i++) {
-		SystemId system_id = static_cast<SystemId>(i);
-		assert(systems_being_read_from_[system_id] == 0);
-		assert(systems_being_written_to_[system_id] == 0);
-	}
-	unupdated_systems_.clear();
-	currently_updating_systems_.clear();
-	updated_systems_.clear();
-
-	for (size_t i = 0; i < systems_.size(); i++) {
-		unupdated_systems_.insert(systems_[static_cast<SystemId>(i)]->GetSystemId());
-	}
-
-	WakeWorkerThreads();
+	// Thread-safe systems go to the job pool.  The main thread runs the
+	// rest itself, and helps with the pool's jobs in between.
+	systems_updating_ = true;
+	schedule_.BeginFrame();
+	DispatchSystems();
 	while (!IsSystemUpdateComplete()) {
-		SystemId system_id = ClaimSystemToUpdate(true);
-		// Lock the mutex BEFORE we do our comparisons
-		// to make sure no one broadcasts after we commit
-		// to CondWaiting, but before we actually CondWait...
-		SDL_LockMutex(worker_thread_mutex_);
-		if (system_id == kInvalidSystem && !IsSystemUpdateComplete()) {
-			SDL_CondWait(worker_thread_cond_,
-				worker_thread_mutex_);
-			SDL_UnlockMutex(worker_thread_mutex_);
-		} else {
-			SDL_UnlockMutex(worker_thread_mutex_);
-      if (system_id != kInvalidSystem) {
-        SystemInterface* system = GetSystem(system_id);
-        system->UpdateAllEntities(delta_time_);
-        MarkSystemAsUpdated(system_id);
-      }
-			WakeWorkerThreads();
+		uint32_t epoch = job_pool_.epoch();
+		uint64_t claim_start = TraceTimestamp();
+		SystemId system_id = schedule_.Claim(false);
+		TraceSpan(thread_index, SchedulerTrace::kClaimSpan, system_id,
+				claim_start);
+		if (system_id != kInvalidSystem) {
+			UpdateSystem(system_id, thread_index);
+		} else if (!job_pool_.RunPendingJob()) {
+			job_pool_.Idle(epoch);
 		}
 	}
+	systems_updating_ = false;
 
-	// Sanity checking - we should not be reading/writing from anything
-	// when we are done with updates.
-	SDL_LockMutex(bookkeeping_mutex_);
-	for (size_t i = 0; i < systems_.size(); i++) {
-		SystemId system_id = static_cast<SystemId>(i);
-		if (systems_being_read_from_[system_id] != 0) {
-			printf("System not finished: [%s]\n", GetSystem(system_id)->Name());
-		}
-		assert(systems_being_read_from_[system_id] == 0);
-		assert(systems_being_written_to_[system_id] == 0);
-	}
-	SDL_UnlockMutex(bookkeeping_mutex_);
+	PlaybackCommands();
 
   // Post updates:
   for (size_t i = 0; i < systems_.size(); i++) {
@@ -200,225 +259,76 @@ void EntityManager::UpdateSystems(WorldTime delta_time) {
   }
 
 	DeleteMarkedEntities();
-}
 
-bool EntityManager::IsSystemUpdateComplete() {
-	// Have to lock the bookkeeping mutex, so that it doesn't change 
-	// while we're checking this.  (Which will lead to false positives...)
-	SDL_LockMutex(bookkeeping_mutex_);
-	bool result = !(unupdated_systems_.size() +
-		currently_updating_systems_.size() > 0);
-	SDL_UnlockMutex(bookkeeping_mutex_);
-	return result;
+	if (scheduler_trace_) scheduler_trace_->EndFrame();
 }
 
-void EntityManager::WakeWorkerThreads() {
-	// tell every other worker thread (and the main game!) that
-	// something completed.
-	SDL_LockMutex(worker_thread_mutex_);
-	SDL_CondBroadcast(worker_thread_cond_);
-	SDL_UnlockMutex(worker_thread_mutex_);
-}
-
-/// @brief Searches through unupdated systems until it finds one that
-/// is legal to begin updating.  (No unupdated dependencies, and no
-/// read/write blocks.)
-///
-/// @param[in] is_for_main_thread If set to true, FindSystemToUpdate will
-/// try to return systems that need to execute from the main thread, and
-/// will not return systems that can't.
-///
-/// @return The system ID of the system to update.  Returns kInvalidSystem
-/// if none could be found.
-SystemId EntityManager::ClaimSystemToUpdate(bool is_for_main_thread) {
-	SystemId result = kInvalidSystem;
-
-	// Mutex begin!  (need to make sure this data doesn't change out from
-	// under us while we're evaluating it.)
-	SDL_LockMutex(bookkeeping_mutex_);
-
-	// Todo:  Make this smarter, so that it favors getting things out of the
-	// way earlier, if they have lots of dependencies.
-	for (auto itr = unupdated_systems_.begin();
-		itr != unupdated_systems_.end(); ++itr) {
-		SystemId current_id = *itr;
-		SystemInterface* current_system = GetSystem(current_id);
-		assert(current_system);
-
-
-		bool current_system_ok = true;
-
-		// Check that all dependencies have been updated.
-		for (auto dep = current_system->ExecuteDependencies()->begin();
-			  dep != current_system->ExecuteDependencies()->end(); ++dep) {
-			if (updated_systems_.find(*dep) == updated_systems_.end()) {
-				// it has one or more dependencies that need to be
-				// executed before it can execute.
-				current_system_ok = false;
-				break;
-			}
-		}
-		if (!current_system_ok) continue;
-
-		// Check that this system doesn't need access to anything that someone
-		// else is writing.
-		for (auto dep = current_system->AccessDependencies()->begin();
-			dep != current_system->AccessDependencies()->end(); ++dep) {
-			// If someone else is writing to a system we need (for read or write)
-			// then this won't work. Keep looking.
-			if (systems_being_written_to_[dep->first] != 0) {
-				current_system_ok = false;
-				break;
-			}
-			// If we need to write to a system, then we also need to make
-			// sure that no one else is reading from it.
-			if (dep->second == kReadWriteAccess &&
-				  systems_being_read_from_[dep->first] != 0) {
-				current_system_ok = false;
-				break;
-			}
-
-		}
-		if (!current_system_ok) continue;
-
-		// If we've made it this far, we've found a good system.
-
-		// Check to make sure that it matches main_thread_only.
-		if (is_for_main_thread) {
-			// If we're looking for something for the main thread,
-			// favor things that are not thread-safe over things that are,
-			// to try to save the thread-safe stuff for worker threads.
-			if (current_system->IsThreadSafe()) {
-				// we're going to remember this one, but it's not ideal,
-				// since it's thread safe.  (So some worker thread could
-				// handle it instead of the main thread, if we wanted.)
-				// So we'll keep looking, just in case we find something
-				// better.
-				result = current_id;
-				continue;
-			} else {
-				// This is not thread safe, so it's a great thing to have
-				// the main thread work on next.  Select it!
-				result = current_id;
-				break;
-			}
-		} else {
-			// If we're looking for something for a worker thread, then
-			// just return the first thread-safe thing we can find.
-			if (current_system->IsThreadSafe()) {
-				// We have a thread-safe system, and they are asking for one.
-				// Give it to them!
-				result = current_id;
-				break;
-			} else {
-				// Can't return something that's not threadsafe if they
-				// are asking for something to run on a thread...
-				continue;
-			}
-		}
+void EntityManager::UpdateSystem(SystemId system_id, int thread_index) {
+	EntityCommandBuffer* commands = command_buffers_[thread_index].get();
+	SystemId outer_system = commands->BeginSystem(system_id);
+	uint64_t run_start = SchedulerTrace::Now();
+	GetSystem(system_id)->UpdateAllEntities(delta_time_);
+	uint64_t run_end = SchedulerTrace::Now();
+	commands->EndSystem(outer_system);
+	if (scheduler_trace_) {
+		scheduler_trace_->RecordSpan(thread_index, SchedulerTrace::kRunSpan,
+				system_id, run_start, run_end);
 	}
 
-	if (result != kInvalidSystem)
-		MarkSystemAsUpdating(result);
-	// Mutex end!
+	uint64_t mark_start = TraceTimestamp();
+	schedule_.Complete(system_id, run_end - run_start);
+	TraceSpan(thread_index, SchedulerTrace::kMarkUpdatedSpan, system_id,
+			mark_start);
 
-	SDL_UnlockMutex(bookkeeping_mutex_);
-
-	return result;
+	DispatchSystems();
+	// The main thread may be waiting for something other than a job:  a
+	// system that has to run on it, or the end of the frame.
+	if (schedule_.HasReadyMainThreadSystems() || IsSystemUpdateComplete()) {
+		job_pool_.WakeAll();
+	}
 }
 
-void EntityManager::MarkSystemAsUpdating(SystemId systemId) {
-	//  NOTE:  We do NOT need to lock the mutex here, becuase
-	// this function is only ever called from witin ClaimSystemToUpdate.
-	//  ALSO NOTE:  Do not call this function from anywhere except
-	// from within ClaimSystemToUpdate.
-	// verify that this system has not been updated yet.
-	assert(unupdated_systems_.find(systemId) != unupdated_systems_.end());
-
-	// Move it to the list of systems being updated.
-	unupdated_systems_.erase(systemId);
-	currently_updating_systems_.insert(systemId);
-
-	SystemInterface* system = GetSystem(systemId);
-
-	// Mark its dependencies as in-use.
-	for (auto dep = system->AccessDependencies()->begin();
-		dep != system->AccessDependencies()->end(); ++dep) {
-		switch (dep->second) {
-		case kReadAccess:
-			systems_being_read_from_[dep->first]++;
-			break;
-		case kReadWriteAccess:
-			// You should never be writing to something that someone else
-			// is already modifying.
-			assert(systems_being_written_to_[dep->first] == 0);
-			systems_being_written_to_[dep->first]++;
-			break;
-		default:
-			// If you got here, something is very wrong.
-			assert(false);
+void EntityManager::DispatchSystems() {
+	for (;;) {
+		int thread_index = job_pool_.CurrentThreadIndex();
+		uint64_t claim_start = TraceTimestamp();
+		SystemId system_id = schedule_.Claim(true);
+		if (thread_index >= 0) {
+			TraceSpan(thread_index, SchedulerTrace::kClaimSpan, system_id,
+					claim_start);
 		}
+		if (system_id == kInvalidSystem) break;
+		job_pool_.Submit(&system_jobs_[system_id].job);
 	}
 }
 
-void EntityManager::MarkSystemAsUpdated(SystemId systemId) {
-	SDL_LockMutex(bookkeeping_mutex_);
-
-	assert(currently_updating_systems_.find(systemId) !=
-		currently_updating_systems_.end());
-
-	// Move it to the list of systems being updated.
-	currently_updating_systems_.erase(systemId);
-	updated_systems_.insert(systemId);
-
-	SystemInterface* system = GetSystem(systemId);
-
-	// Mark its dependencies as in-use.
-	for (auto dep = system->AccessDependencies()->begin();
-		dep != system->AccessDependencies()->end(); ++dep) {
-		switch (dep->second) {
-		case kReadAccess:
-			systems_being_read_from_[dep->first]--;
-			// If this goes below zero, our bookkeeping is probably off.
-			assert(systems_being_read_from_[dep->first] >= 0);
-			break;
-		case kReadWriteAccess:
-			// You should never be writing to something that someone else
-			// is already modifying.
-			systems_being_written_to_[dep->first]--;
-			assert(systems_being_written_to_[dep->first] >= 0);
-			break;
-		default:
-			// If you got here, something is very wrong.
-			assert(false);
-		}
+void EntityManager::PlaybackCommands() {
+	// Each system runs on one thread per frame, so its commands are all in
+	// one buffer, in order.  Sorting by system (stably, so a system whose
+	// run was interrupted keeps its order) makes playback independent of
+	// which thread ran what.
+	typedef std::pair<const EntityCommandBuffer*, EntityCommandBuffer::Segment>
+			BufferSegment;
+	std::vector<BufferSegment> segments;
+	for (size_t i = 0; i < command_buffers_.size(); i++) {
+		command_buffers_[i]->CloseSegments(&segments);
+	}
+	std::stable_sort(segments.begin(), segments.end(),
+			[](const BufferSegment& a, const BufferSegment& b) {
+				return a.second.system_id < b.second.system_id;
+			});
+	for (size_t i = 0; i < segments.size(); i++) {
+		segments[i].first->Playback(segments[i].second);
+	}
+	for (size_t i = 0; i < command_buffers_.size(); i++) {
+		command_buffers_[i]->Reset();
 	}
-
-	SDL_UnlockMutex(bookkeeping_mutex_);
 }
 
-
-// This is what one of our worker threads looks like....
-int EntityManager::EntityManagerWorkerThread(void * data) {
-	EntityManager* entity_manager = static_cast<EntityManager*>(data);
-	while (!entity_manager->exit_worker_threads_) {
-		SystemId system_id = entity_manager->ClaimSystemToUpdate(false);
-		if (system_id == kInvalidSystem) {
-			SDL_LockMutex(entity_manager->worker_thread_mutex_);
-			SDL_CondWait(entity_manager->worker_thread_cond_,
-				  entity_manager->worker_thread_mutex_);
-			SDL_UnlockMutex(entity_manager->worker_thread_mutex_);
-		} else {
-			SystemInterface* system = entity_manager->GetSystem(system_id);
-			system->UpdateAllEntities(entity_manager->delta_time_);
-			entity_manager->MarkSystemAsUpdated(system_id);
-
-			// tell every other worker thread (and the main game!) that
-			// something completed.
-			entity_manager->WakeWorkerThreads();
-		}
-	}
-	return 0;
+void EntityManager::SystemJob(void* data, int thread_index) {
+	SystemJobData* system_job = static_cast<SystemJobData*>(data);
+	system_job->entity_manager->UpdateSystem(system_job->system_id,
+			thread_index);
 }
 
 void EntityManager::Clear() {
@@ -431,6 +341,11 @@ void EntityManager::Clear() {
   systems_.clear();
 	entities_.clear();
 	entities_to_delete_.clear();
+	for (size_t i = 0; i < command_buffers_.size(); i++) {
+		command_buffers_[i]->Reset();
+	}
+	entity_slots_.clear();
+	free_entity_slots_.clear();
 }
 
 Entity EntityManager::CreateEntityFromData(const void* data) {
@@ -0,0 +1,293 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <assert.h>
+#include <algorithm>
+#include "corgi/job_pool.h"
+#include "corgi/scheduler_trace.h"
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <emmintrin.h>
+#endif
+
+namespace corgi {
+
+// How many times an idle thread checks for new work before parking.
+static const int kSpinCount = 4000;
+
+// Which pool the current thread belongs to, and its index in it.
+static thread_local const JobPool* tls_pool = nullptr;
+static thread_local int tls_thread_index = -1;
+
+// Tells the CPU we're in a spin loop.
+static inline void CpuRelax() {
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+  _mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+#endif
+}
+
+bool JobPool::JobDeque::Push(Job* job) {
+  int64_t bottom = bottom_.load(std::memory_order_relaxed);
+  int64_t top = top_.load(std::memory_order_acquire);
+  if (bottom - top >= kCapacity) return false;
+  buffer_[bottom & kMask].store(job, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  bottom_.store(bottom + 1, std::memory_order_relaxed);
+  return true;
+}
+
+JobPool::Job* JobPool::JobDeque::Pop() {
+  int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+  bottom_.store(bottom, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t top = top_.load(std::memory_order_relaxed);
+
+  if (top > bottom) {
+    // Empty.
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  Job* job = buffer_[bottom & kMask].load(std::memory_order_relaxed);
+  if (top == bottom) {
+    // Last one, so race any thieves for it.
+    if (!top_.compare_exchange_strong(top, top + 1,
+                                      std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      job = nullptr;
+    }
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+  }
+  return job;
+}
+
+JobPool::Job* JobPool::JobDeque::Steal() {
+  int64_t top = top_.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t bottom = bottom_.load(std::memory_order_acquire);
+  if (top >= bottom) return nullptr;
+
+  Job* job = buffer_[top & kMask].load(std::memory_order_relaxed);
+  if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                    std::memory_order_relaxed)) {
+    // Lost the race to another thief, or the owner.
+    return nullptr;
+  }
+  return job;
+}
+
+JobPool::JobPool()
+    : external_mutex_(SDL_CreateMutex()),
+      external_job_count_(0),
+      park_mutex_(SDL_CreateMutex()),
+      park_cond_(SDL_CreateCond()),
+      epoch_(0),
+      parked_count_(0),
+      exit_(false),
+      scheduler_trace_(nullptr) {}
+
+JobPool::~JobPool() {
+  exit_ = true;
+  WakeAll();
+  for (size_t i = 0; i < threads_.size(); i++) {
+    SDL_WaitThread(threads_[i], nullptr);
+  }
+  threads_.clear();
+  if (tls_pool == this) {
+    tls_pool = nullptr;
+    tls_thread_index = -1;
+  }
+
+  SDL_DestroyMutex(external_mutex_);
+  SDL_DestroyMutex(park_mutex_);
+  SDL_DestroyCond(park_cond_);
+}
+
+int JobPool::DefaultWorkerCount() {
+  return std::max(SDL_GetCPUCount() - 1, 0);
+}
+
+void JobPool::Start(int worker_count) {
+  if (!queues_.empty()) return;
+  if (worker_count < 0) worker_count = DefaultWorkerCount();
+
+  tls_pool = this;
+  tls_thread_index = 0;
+
+  // Everything the threads touch is set up before any of them start.
+  for (int i = 0; i < worker_count + 1; i++) {
+    queues_.push_back(std::unique_ptr<JobDeque>(new JobDeque()));
+  }
+  thread_data_.resize(worker_count);
+  for (int i = 0; i < worker_count; i++) {
+    thread_data_[i].pool = this;
+    thread_data_[i].thread_index = i + 1;
+  }
+  for (int i = 0; i < worker_count; i++) {
+    threads_.push_back(SDL_CreateThread(JobPool::WorkerThread, "JobPoolWorker",
+                                        &thread_data_[i]));
+  }
+}
+
+int JobPool::CurrentThreadIndex() const {
+  return tls_pool == this ? tls_thread_index : -1;
+}
+
+void JobPool::Submit(Job* job) {
+  assert(job && job->function);
+  if (job->counter) job->counter->fetch_add(1);
+
+  int thread_index = CurrentThreadIndex();
+  if (thread_index >= 0) {
+    if (!queues_[thread_index]->Push(job)) {
+      // Our deque is full, so there's plenty to go around already.
+      RunJob(job, thread_index);
+      return;
+    }
+  } else {
+    SDL_LockMutex(external_mutex_);
+    external_jobs_.push_back(job);
+    external_job_count_++;
+    SDL_UnlockMutex(external_mutex_);
+  }
+  Notify();
+}
+
+bool JobPool::RunPendingJob() {
+  int thread_index = CurrentThreadIndex();
+  Job* job = FindJob(thread_index);
+  if (!job) return false;
+  RunJob(job, thread_index);
+  return true;
+}
+
+void JobPool::Wait(const JobCounter* counter) {
+  while (counter->load() != 0) {
+    uint32_t seen_epoch = epoch();
+    if (RunPendingJob()) continue;
+    if (counter->load() == 0) break;
+    Idle(seen_epoch);
+  }
+}
+
+void JobPool::Idle(uint32_t seen_epoch) {
+  for (int i = 0; i < kSpinCount; i++) {
+    if (epoch_.load(std::memory_order_relaxed) != seen_epoch) return;
+    CpuRelax();
+  }
+  Park(seen_epoch, CurrentThreadIndex());
+}
+
+void JobPool::WakeAll() {
+  epoch_++;
+  if (parked_count_.load() > 0) {
+    SDL_LockMutex(park_mutex_);
+    SDL_CondBroadcast(park_cond_);
+    SDL_UnlockMutex(park_mutex_);
+  }
+}
+
+// One new job, so wake (at most) one thread for it.
+void JobPool::Notify() {
+  epoch_++;
+  if (parked_count_.load() > 0) {
+    SDL_LockMutex(park_mutex_);
+    SDL_CondSignal(park_cond_);
+    SDL_UnlockMutex(park_mutex_);
+  }
+}
+
+void JobPool::Park(uint32_t seen_epoch, int thread_index) {
+  // parked_count_ goes up before the epoch is checked, and Notify bumps the
+  // epoch before checking parked_count_, so either we see the new epoch, or
+  // Notify sees us and signals under the mutex we're holding.
+  SDL_LockMutex(park_mutex_);
+  parked_count_++;
+  if (epoch_.load() == seen_epoch && !exit_) {
+    uint64_t wait_start = (scheduler_trace_ && scheduler_trace_->enabled() &&
+                           thread_index >= 0) ? SchedulerTrace::Now() : 0;
+    SDL_CondWait(park_cond_, park_mutex_);
+    if (wait_start) {
+      scheduler_trace_->RecordSpan(thread_index, SchedulerTrace::kWaitSpan,
+                                   kInvalidSystem, wait_start);
+    }
+  }
+  parked_count_--;
+  SDL_UnlockMutex(park_mutex_);
+}
+
+JobPool::Job* JobPool::FindJob(int thread_index) {
+  // Our own work first, newest first, since it's probably still in cache.
+  if (thread_index >= 0) {
+    Job* job = queues_[thread_index]->Pop();
+    if (job) return job;
+  }
+
+  if (external_job_count_.load() > 0) {
+    Job* job = nullptr;
+    SDL_LockMutex(external_mutex_);
+    if (!external_jobs_.empty()) {
+      job = external_jobs_.front();
+      external_jobs_.erase(external_jobs_.begin());
+      external_job_count_--;
+    }
+    SDL_UnlockMutex(external_mutex_);
+    if (job) return job;
+  }
+
+  // Then steal, oldest first, starting with our neighbor so that thieves
+  // spread out.
+  size_t queue_count = queues_.size();
+  size_t start = thread_index >= 0 ? thread_index + 1 : 0;
+  for (size_t i = 0; i < queue_count; i++) {
+    size_t victim = (start + i) % queue_count;
+    if (static_cast<int>(victim) == thread_index) continue;
+    Job* job = queues_[victim]->Steal();
+    if (job) return job;
+  }
+  return nullptr;
+}
+
+void JobPool::RunJob(Job* job, int thread_index) {
+  // Read everything we need up front:  once the counter hits zero, the
+  // submitter is free to reuse the job.
+  JobCounter* counter = job->counter;
+  job->function(job->data, thread_index);
+  if (counter && counter->fetch_sub(1) == 1) {
+    // Whoever is waiting on the group may be parked.
+    WakeAll();
+  }
+}
+
+int JobPool::WorkerThread(void* data) {
+  WorkerThreadData* thread_data = static_cast<WorkerThreadData*>(data);
+  JobPool* pool = thread_data->pool;
+  int thread_index = thread_data->thread_index;
+  tls_pool = pool;
+  tls_thread_index = thread_index;
+
+  while (!pool->exit_) {
+    uint32_t seen_epoch = pool->epoch();
+    Job* job = pool->FindJob(thread_index);
+    if (job) {
+      pool->RunJob(job, thread_index);
+    } else {
+      pool->Idle(seen_epoch);
+    }
+  }
+  return 0;
+}
+
+}  // corgi
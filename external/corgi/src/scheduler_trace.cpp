@@ -0,0 +1,216 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <assert.h>
+#include <algorithm>
+#include "corgi/scheduler_trace.h"
+#include "corgi/entity_manager.h"
+#include "corgi/system_interface.h"
+
+namespace corgi {
+
+static const char* kSpanNames[SchedulerTrace::kSpanTypeCount] = {
+  "claim", "run", "mark-updated", "wait", "UpdateSystems",
+};
+
+SchedulerTrace::SchedulerTrace(int rolling_window_frames)
+    : enabled_(false),
+      ticks_per_second_(static_cast<double>(SDL_GetPerformanceFrequency())),
+      rolling_window_frames_(rolling_window_frames > 0 ?
+          rolling_window_frames : 1),
+      frames_recorded_(0),
+      frame_start_(0),
+      capture_frames_remaining_(0),
+      capture_start_(0) {}
+
+SchedulerTrace::~SchedulerTrace() {
+  for (size_t i = 0; i < thread_buffers_.size(); i++) {
+    delete thread_buffers_[i];
+  }
+}
+
+void SchedulerTrace::Init(EntityManager* entity_manager, int thread_count) {
+  // Init is only allowed once - worker threads hold on to their buffers.
+  assert(thread_buffers_.empty());
+
+  for (int i = 0; i < thread_count; i++) {
+    thread_buffers_.push_back(new ThreadBuffer());
+  }
+  thread_totals_.resize(thread_count,
+      std::vector<ThreadTotals>(rolling_window_frames_));
+
+  for (size_t i = 0; i < entity_manager->SystemCount(); i++) {
+    SystemInterface* system =
+        entity_manager->GetSystem(static_cast<SystemId>(i));
+    system_names_.push_back(system ? system->Name() : "(null)");
+  }
+  system_run_ticks_.resize(system_names_.size(),
+      std::vector<uint64_t>(rolling_window_frames_, 0));
+}
+
+void SchedulerTrace::StartCapture(int max_frames) {
+  captured_spans_.clear();
+  capture_frames_remaining_ = max_frames;
+  capture_start_ = Now();
+  enabled_ = true;
+}
+
+void SchedulerTrace::RecordSpan(int thread_index, SpanType type,
+                                SystemId system_id, uint64_t start,
+                                uint64_t end) {
+  if (!enabled_) return;
+  assert(thread_index >= 0 &&
+         thread_index < static_cast<int>(thread_buffers_.size()));
+
+  Span span;
+  span.start = start;
+  span.end = end;
+  span.system_id = system_id;
+  span.type = static_cast<uint8_t>(type);
+  span.thread_index = static_cast<uint8_t>(thread_index);
+
+  ThreadBuffer* buffer = thread_buffers_[thread_index];
+  SDL_LockMutex(buffer->mutex);
+  buffer->spans.push_back(span);
+  SDL_UnlockMutex(buffer->mutex);
+}
+
+void SchedulerTrace::BeginFrame() {
+  if (!enabled_) return;
+  frame_start_ = Now();
+}
+
+void SchedulerTrace::EndFrame() {
+  if (!enabled_) return;
+  RecordSpan(0, kFrameSpan, kInvalidSystem, frame_start_, Now());
+
+  // Pull everything the threads recorded this frame.
+  scratch_spans_.clear();
+  for (size_t i = 0; i < thread_buffers_.size(); i++) {
+    ThreadBuffer* buffer = thread_buffers_[i];
+    SDL_LockMutex(buffer->mutex);
+    scratch_spans_.insert(scratch_spans_.end(), buffer->spans.begin(),
+                          buffer->spans.end());
+    buffer->spans.clear();
+    SDL_UnlockMutex(buffer->mutex);
+  }
+
+  // Fold them into this frame's slot in the rolling window.
+  int slot = frames_recorded_ % rolling_window_frames_;
+  for (size_t i = 0; i < system_run_ticks_.size(); i++) {
+    system_run_ticks_[i][slot] = 0;
+  }
+  for (size_t i = 0; i < thread_totals_.size(); i++) {
+    thread_totals_[i][slot] = ThreadTotals();
+  }
+  // A thread that parked at the end of the last frame only records its
+  // wait when it wakes in this one, so that wait is clipped to the start of
+  // this frame.  Otherwise the time between frames would count as this
+  // frame's wait.
+  for (size_t i = 0; i < scratch_spans_.size(); i++) {
+    const Span& span = scratch_spans_[i];
+    uint64_t start = std::max(span.start, frame_start_);
+    uint64_t ticks = span.end > start ? span.end - start : 0;
+    if (span.type == kRunSpan && span.system_id < system_run_ticks_.size()) {
+      system_run_ticks_[span.system_id][slot] += ticks;
+    }
+    thread_totals_[span.thread_index][slot].ticks[span.type] += ticks;
+  }
+  frames_recorded_++;
+
+  if (capture_frames_remaining_ > 0) {
+    captured_spans_.insert(captured_spans_.end(), scratch_spans_.begin(),
+                           scratch_spans_.end());
+    capture_frames_remaining_--;
+  }
+}
+
+bool SchedulerTrace::WriteChromeTrace(const char* path) const {
+  FILE* file = fopen(path, "w");
+  if (file == nullptr) {
+    printf("Unable to open %s for writing!\n", path);
+    return false;
+  }
+
+  fprintf(file, "{\"traceEvents\":[\n");
+  for (size_t i = 0; i < thread_buffers_.size(); i++) {
+    fprintf(file,
+        "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+        "\"args\":{\"name\":\"%s %d\"}},\n",
+        static_cast<int>(i), i == 0 ? "main" : "worker", static_cast<int>(i));
+  }
+  for (size_t i = 0; i < captured_spans_.size(); i++) {
+    const Span& span = captured_spans_[i];
+    const char* name = span.system_id < system_names_.size() ?
+        system_names_[span.system_id].c_str() : kSpanNames[span.type];
+    // Spans that started before the capture (long waits, usually) get
+    // clipped to the start of it.
+    uint64_t start = std::max(span.start, capture_start_);
+    uint64_t end = std::max(span.end, start);
+    fprintf(file,
+        "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+        "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}\n",
+        i == 0 ? "" : ",", name, kSpanNames[span.type],
+        static_cast<int>(span.thread_index),
+        TicksToMs(start - capture_start_) * 1000.0,
+        TicksToMs(end - start) * 1000.0);
+  }
+  fprintf(file, "]}\n");
+  fclose(file);
+  return true;
+}
+
+void SchedulerTrace::PrintSystemTable(FILE* out) const {
+  int frames = std::min(frames_recorded_, rolling_window_frames_);
+  fprintf(out, "scheduler trace, last %d frames (ms)\n", frames);
+  if (frames == 0) return;
+
+  fprintf(out, "  %-24s %9s %9s %9s %9s\n", "system", "min", "avg", "p99",
+          "max");
+  std::vector<uint64_t> sorted;
+  for (size_t i = 0; i < system_run_ticks_.size(); i++) {
+    sorted.assign(system_run_ticks_[i].begin(),
+                  system_run_ticks_[i].begin() + frames);
+    std::sort(sorted.begin(), sorted.end());
+    uint64_t total = 0;
+    for (size_t j = 0; j < sorted.size(); j++) total += sorted[j];
+    size_t p99_rank = static_cast<size_t>(0.99 * sorted.size() + 0.5);
+    if (p99_rank < 1) p99_rank = 1;
+    fprintf(out, "  %-24s %9.3f %9.3f %9.3f %9.3f\n",
+            system_names_[i].c_str(), TicksToMs(sorted.front()),
+            TicksToMs(total) / frames, TicksToMs(sorted[p99_rank - 1]),
+            TicksToMs(sorted.back()));
+  }
+
+  fprintf(out, "  %-24s %9s %9s %9s %9s\n", "thread (avg/frame)", "claim",
+          "run", "mark", "wait");
+  for (size_t i = 0; i < thread_totals_.size(); i++) {
+    ThreadTotals sum;
+    for (int j = 0; j < frames; j++) {
+      for (int type = 0; type < kSpanTypeCount; type++) {
+        sum.ticks[type] += thread_totals_[i][j].ticks[type];
+      }
+    }
+    char label[32];
+    snprintf(label, sizeof(label), "%s %d", i == 0 ? "main" : "worker",
+             static_cast<int>(i));
+    fprintf(out, "  %-24s %9.3f %9.3f %9.3f %9.3f\n", label,
+            TicksToMs(sum.ticks[kClaimSpan]) / frames,
+            TicksToMs(sum.ticks[kRunSpan]) / frames,
+            TicksToMs(sum.ticks[kMarkUpdatedSpan]) / frames,
+            TicksToMs(sum.ticks[kWaitSpan]) / frames);
+  }
+}
+
+}  // corgi
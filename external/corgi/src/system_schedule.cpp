@@ -0,0 +1,206 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "corgi/system_interface.h"
+#include "corgi/system_schedule.h"
+
+namespace corgi {
+
+// How much each frame's measured time moves a system's cost estimate.
+static const double kCostSmoothing = 0.1;
+
+// Until a system has been timed, every system costs the same, so the
+// priorities just count hops along the longest chain.
+static const double kUnmeasuredCost = 1.0;
+
+SystemSchedule::SystemSchedule()
+    : system_count_(0),
+      initially_ready_(0),
+      thread_safe_mask_(0),
+      state_(0),
+      completed_count_(0),
+      epoch_(0) {}
+
+void SystemSchedule::Build(const std::vector<SystemInterface*>& systems) {
+  system_count_ = systems.size();
+  // Past this, the bit masks overflow, and systems would silently run
+  // alongside ones they conflict with.  So this can't just be an assert.
+  if (system_count_ > kMaxSystems) {
+    fprintf(stderr, "corgi: %d systems registered, but the schedule "
+            "supports at most %d.\n", static_cast<int>(system_count_),
+            static_cast<int>(kMaxSystems));
+    abort();
+  }
+
+  successors_.assign(system_count_, std::vector<SystemId>());
+  predecessor_count_.assign(system_count_, 0);
+  conflict_mask_.assign(system_count_, 0);
+  cost_.assign(system_count_, kUnmeasuredCost);
+  priority_.assign(system_count_, 0.0);
+  initially_ready_ = 0;
+  thread_safe_mask_ = 0;
+
+  // Who reads and who writes each system's data.  (Indexed by the system
+  // being accessed, with a bit per accessor.)
+  std::vector<uint64_t> readers(system_count_, 0);
+  std::vector<uint64_t> writers(system_count_, 0);
+
+  for (SystemId id = 0; id < system_count_; id++) {
+    SystemInterface* system = systems[id];
+    assert(system);
+    if (system->IsThreadSafe()) thread_safe_mask_ |= ReadyBit(id);
+
+    auto execute_dependencies = system->ExecuteDependencies();
+    for (auto dep = execute_dependencies->begin();
+         dep != execute_dependencies->end(); ++dep) {
+      assert(*dep < system_count_);
+      successors_[*dep].push_back(id);
+      predecessor_count_[id]++;
+    }
+
+    writers[id] |= uint64_t(1) << id;
+    auto access_dependencies = system->AccessDependencies();
+    for (auto dep = access_dependencies->begin();
+         dep != access_dependencies->end(); ++dep) {
+      assert(dep->first < system_count_);
+      if (dep->second == kReadWriteAccess) {
+        writers[dep->first] |= uint64_t(1) << id;
+      } else if (dep->second == kReadAccess) {
+        readers[dep->first] |= uint64_t(1) << id;
+      }
+    }
+  }
+
+  // Two systems conflict if either one writes something the other touches.
+  for (SystemId target = 0; target < system_count_; target++) {
+    uint64_t touchers = readers[target] | writers[target];
+    for (SystemId id = 0; id < system_count_; id++) {
+      uint64_t bit = uint64_t(1) << id;
+      uint64_t conflicts = 0;
+      if (writers[target] & bit) conflicts |= touchers;
+      if (touchers & bit) conflicts |= writers[target];
+      conflict_mask_[id] |= (conflicts & ~bit) << kMaxSystems;
+    }
+  }
+
+  // Sort topologically, which also catches cycles.
+  topological_order_.clear();
+  std::vector<int> remaining(predecessor_count_);
+  for (SystemId id = 0; id < system_count_; id++) {
+    if (remaining[id] == 0) {
+      topological_order_.push_back(id);
+      initially_ready_ |= ReadyBit(id);
+    }
+  }
+  for (size_t i = 0; i < topological_order_.size(); i++) {
+    const std::vector<SystemId>& next = successors_[topological_order_[i]];
+    for (size_t j = 0; j < next.size(); j++) {
+      if (--remaining[next[j]] == 0) topological_order_.push_back(next[j]);
+    }
+  }
+  // If this fires, the execution dependencies have a cycle in them.
+  assert(topological_order_.size() == system_count_);
+
+  remaining_predecessors_.reset(new std::atomic<int>[system_count_]);
+  state_ = 0;
+  completed_count_ = system_count_;
+  UpdatePriorities();
+}
+
+// A system's priority is its own cost plus the costliest chain of
+// successors after it, so systems on the critical path go first.
+void SystemSchedule::UpdatePriorities() {
+  for (size_t i = topological_order_.size(); i-- > 0;) {
+    SystemId id = topological_order_[i];
+    double longest_successor = 0.0;
+    for (size_t j = 0; j < successors_[id].size(); j++) {
+      longest_successor =
+          std::max(longest_successor, priority_[successors_[id][j]]);
+    }
+    priority_[id] = cost_[id] + longest_successor;
+  }
+
+  priority_order_ = topological_order_;
+  std::stable_sort(priority_order_.begin(), priority_order_.end(),
+                   [this](SystemId a, SystemId b) {
+                     return priority_[a] > priority_[b];
+                   });
+}
+
+void SystemSchedule::BeginFrame() {
+  assert(IsFrameComplete());
+  assert(state_.load() == 0);
+  UpdatePriorities();
+  for (size_t i = 0; i < system_count_; i++) {
+    remaining_predecessors_[i] = predecessor_count_[i];
+  }
+  completed_count_ = 0;
+  state_ = initially_ready_;
+  epoch_++;
+}
+
+SystemId SystemSchedule::Claim(bool thread_safe) {
+  uint64_t candidates = state_.load() & kReadyMask &
+                        (thread_safe ? thread_safe_mask_ : ~thread_safe_mask_);
+  if (!candidates) return kInvalidSystem;
+
+  for (size_t i = 0; i < priority_order_.size(); i++) {
+    SystemId id = priority_order_[i];
+    if ((candidates & ReadyBit(id)) && TryClaim(id)) return id;
+  }
+  return kInvalidSystem;
+}
+
+bool SystemSchedule::TryClaim(SystemId id) {
+  uint64_t state = state_.load();
+  do {
+    if (!(state & ReadyBit(id)) || (state & conflict_mask_[id])) {
+      return false;
+    }
+  } while (!state_.compare_exchange_weak(
+      state, (state & ~ReadyBit(id)) | RunningBit(id)));
+  return true;
+}
+
+void SystemSchedule::Complete(SystemId system_id, uint64_t run_ticks) {
+  assert(state_.load() & RunningBit(system_id));
+  double ticks = static_cast<double>(run_ticks);
+  if (cost_[system_id] == kUnmeasuredCost) {
+    cost_[system_id] = ticks;
+  } else {
+    cost_[system_id] += (ticks - cost_[system_id]) * kCostSmoothing;
+  }
+
+  // Release successors before dropping the running bit, so that anyone
+  // who sees this system finish also sees what it unblocked.
+  uint64_t newly_ready = 0;
+  const std::vector<SystemId>& next = successors_[system_id];
+  for (size_t i = 0; i < next.size(); i++) {
+    if (remaining_predecessors_[next[i]].fetch_sub(1) == 1) {
+      newly_ready |= ReadyBit(next[i]);
+    }
+  }
+  uint64_t state = state_.load();
+  while (!state_.compare_exchange_weak(
+      state, (state & ~RunningBit(system_id)) | newly_ready)) {
+  }
+  completed_count_++;
+  epoch_++;
+}
+
+}  // corgi
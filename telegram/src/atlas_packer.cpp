@@ -0,0 +1,73 @@
+#include "atlas_packer.h"
+
+
+SkylinePacker::SkylinePacker(int width, int height)
+    : width_(width),
+      height_(height),
+      used_area_(0) {
+  Segment floor = { 0, 0, width };
+  skyline_.push_back(floor);
+}
+
+int SkylinePacker::FitAt(size_t index, int width, int height) const {
+  int x = skyline_[index].x;
+  if (x + width > width_) return -1;
+
+  // It has to clear every segment it spans.
+  int y = 0;
+  int width_left = width;
+  for (size_t i = index; width_left > 0; i++) {
+    if (skyline_[i].y > y) y = skyline_[i].y;
+    if (y + height > height_) return -1;
+    width_left -= skyline_[i].width;
+  }
+  return y;
+}
+
+bool SkylinePacker::Pack(int width, int height, int* x, int* y) {
+  if (width <= 0 || height <= 0) return false;
+
+  int best_index = -1;
+  int best_y = height_;
+  for (size_t i = 0; i < skyline_.size(); i++) {
+    int fit_y = FitAt(i, width, height);
+    if (fit_y >= 0 && fit_y < best_y) {
+      best_index = static_cast<int>(i);
+      best_y = fit_y;
+    }
+  }
+  if (best_index < 0) return false;
+
+  // Raise the skyline under the new rectangle...
+  Segment raised = { skyline_[best_index].x, best_y + height, width };
+  skyline_.insert(skyline_.begin() + best_index, raised);
+
+  // ...trim whatever it now covers...
+  int right = raised.x + raised.width;
+  size_t next = best_index + 1;
+  while (next < skyline_.size() && skyline_[next].x < right) {
+    Segment& segment = skyline_[next];
+    int covered = right - segment.x;
+    if (covered < segment.width) {
+      segment.x += covered;
+      segment.width -= covered;
+      break;
+    }
+    skyline_.erase(skyline_.begin() + next);
+  }
+
+  // ...and merge neighbours that ended up level.
+  for (size_t i = 0; i + 1 < skyline_.size();) {
+    if (skyline_[i].y == skyline_[i + 1].y) {
+      skyline_[i].width += skyline_[i + 1].width;
+      skyline_.erase(skyline_.begin() + i + 1);
+    } else {
+      i++;
+    }
+  }
+
+  *x = raised.x;
+  *y = best_y;
+  used_area_ += width * height;
+  return true;
+}
@@ -0,0 +1,47 @@
+#ifndef ATLAS_PACKER_H
+#define ATLAS_PACKER_H
+
+#include <stddef.h>
+#include <vector>
+
+// Packs rectangles into one fixed size page, bottom-left first, by keeping
+// track of the skyline:  the lowest free row in each span of columns.  (Y
+// grows downwards, so "bottom" here is the top of the page.)
+//
+// Each rectangle goes wherever its top edge would sit highest, (ties go to
+// the leftmost) resting on the skyline.  Gaps under overhangs are lost,
+// which is a fair trade for a handful of sprite images.  Works best with
+// the rectangles sorted tallest first.
+class SkylinePacker {
+public:
+  SkylinePacker(int width, int height);
+
+  // Finds room for a width x height rectangle, and claims it.  Returns
+  // false, and leaves x and y alone, if it doesn't fit anywhere.
+  bool Pack(int width, int height, int* x, int* y);
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  // The area claimed so far.
+  int used_area() const { return used_area_; }
+
+private:
+  // Columns x to x + width are free from row y down.
+  struct Segment {
+    int x;
+    int y;
+    int width;
+  };
+
+  // Where a rectangle starting at segment index would have to sit, or -1
+  // if it doesn't fit there.
+  int FitAt(size_t index, int width, int height) const;
+
+  int width_;
+  int height_;
+  int used_area_;
+  // Left to right, covering the whole width.
+  std::vector<Segment> skyline_;
+};
+
+#endif // ATLAS_PACKER_H
@@ -3,10 +3,17 @@
 #include <stdio.h>
 #include "GL/glew.h"
 
-#define MAX_CORGI_THREADS 3
+// Everything the game draws, packed onto one atlas page, so it's drawn
+// together.
+static const char* const kAtlasTextures[] = {
+  "rsc/asteroid.png",
+  "rsc/circle.png",
+  "rsc/ship.png",
+};
 
 MainState::MainState(SDL_Window* window, SDL_Surface* screen_surface,
-	SDL_GLContext context, int screen_width, int screen_height) {
+	SDL_GLContext context, int screen_width, int screen_height)
+    : worker_thread_count_(corgi::JobPool::kDefaultWorkerCount) {
 	CommonComponent* common_data = common_system_.CommonData();
 	common_data->window = window;
 	common_data->screen_surface = screen_surface;
@@ -19,7 +26,16 @@ MainState::MainState(SDL_Window* window, SDL_Surface* screen_surface,
 
 
 void MainState::Init() {
+  if (!IsHeadless()) {
+    for (size_t i = 0; i < sizeof(kAtlasTextures) / sizeof(kAtlasTextures[0]);
+        i++) {
+      texture_manager_.AddToAtlas(InternTexture(kAtlasTextures[i]));
+    }
+    texture_manager_.BuildAtlas();
+  }
+
   corgi::Entity entity = entity_manager_.AllocateNewEntity();
+  sprite_system_.set_headless(IsHeadless());
   entity_manager_.RegisterSystem(&asteroid_system_);
 	entity_manager_.RegisterSystem(&common_system_);
 	entity_manager_.RegisterSystem(&transform_system_);
@@ -29,8 +45,10 @@ void MainState::Init() {
   entity_manager_.RegisterSystem(&player_ship_system_);
   entity_manager_.RegisterSystem(&fade_timer_system_);
   entity_manager_.RegisterSystem(&bullet_system_);
+  entity_manager_.RegisterSystem(&collision_system_);
+  entity_manager_.RegisterSystem(&particle_system_);
 
-	entity_manager_.set_max_worker_threads(MAX_CORGI_THREADS);
+	entity_manager_.set_max_worker_threads(worker_thread_count_);
 
   entity_manager_.FinalizeSystemList();
 
@@ -44,6 +62,8 @@ void MainState::Init() {
 
 
 void MainState::Render(double delta_time) {
+  if (IsHeadless()) return;
+
 	glClearColor(0.25f, 0.25f, 0.25f, 1.0f);
   glClearDepth(0);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -55,6 +75,8 @@ void MainState::Render(double delta_time) {
 
 void MainState::UpdateInput() {
   keyboard_input_.ClearForUpdate();
+  if (IsHeadless()) return;
+
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
@@ -12,6 +12,8 @@
 #include "systems/playership.h"
 #include "systems/fade_timer.h"
 #include "systems/bullet.h"
+#include "systems/collision.h"
+#include "systems/particles.h"
 
 #include "base_state.h"
 #include "keyboard_input.h"
@@ -35,6 +37,20 @@ public:
 
   void UpdateInput();
 
+  // A MainState created without a window runs headless:  systems update
+  // as normal, but nothing is rendered and input is never polled from SDL.
+  // Whoever is driving the state feeds keyboard_input() directly instead.
+  bool IsHeadless() { return common_system_.CommonData()->window == nullptr; }
+
+  // Must be called before Init.  Defaults to one per core, less one for
+  // the main thread.  (corgi::JobPool::kDefaultWorkerCount)
+  void set_worker_thread_count(int worker_thread_count) {
+    worker_thread_count_ = worker_thread_count;
+  }
+
+  corgi::EntityManager* entity_manager() { return &entity_manager_; }
+  KeyboardInput* keyboard_input() { return &keyboard_input_; }
+
 private:
   KeyboardInput keyboard_input_;
   TextureManager texture_manager_;
@@ -51,7 +67,10 @@ private:
   WallBounceSystem wallbounce_system_;
   FadeTimerSystem fade_timer_system_;
   BulletSystem bullet_system_;
+  CollisionSystem collision_system_;
+  ParticleSystem particle_system_;
 
+  int worker_thread_count_;
 
 };
 
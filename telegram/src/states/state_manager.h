@@ -1,7 +1,7 @@
 #ifndef STATEMANAGER_H
 #define STATEMANAGER_H
 #include <memory>
-#include "corgi\entity_manager.h"
+#include "corgi/entity_manager.h"
 #include "base_state.h"
 
 class StateManager {
@@ -16,7 +16,7 @@ public:
 
   int StateCount() { return state_stack_.size(); }
   bool IsAppQuitting() { return is_app_quitting_;  }
-  BaseState* StateManager::GetCurrentlyExecutingState() { return currently_executing_state_; }
+  BaseState* GetCurrentlyExecutingState() { return currently_executing_state_; }
 
 
 private:
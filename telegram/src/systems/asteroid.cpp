@@ -7,8 +7,8 @@
 #include <stdio.h>
 #include "constants.h"
 #include "bullet.h"
-#include <unordered_set>
-#include "fade_timer.h"
+#include "collision.h"
+#include "particles.h"
 
 
 CORGI_DEFINE_SYSTEM(AsteroidSystem, AsteroidData)
@@ -17,25 +17,26 @@ void AsteroidSystem::UpdateAllEntities(corgi::WorldTime delta_time) {
 
   if (begin() == end()) {
     for (int i = 0; i < 2; i++) {
-      corgi::Entity new_asteroid = entity_manager_->AllocateNewEntity();
-      entity_manager_->AddComponent<AsteroidSystem>(new_asteroid);
+      entity_manager_->commands()->CreateEntity(
+          [this](corgi::Entity new_asteroid) {
+        entity_manager_->AddComponent<AsteroidSystem>(new_asteroid);
+      });
     }
   }
 
-  BulletSystem* bullet_system = GetSystem<BulletSystem>();
-  for (auto itr = begin(); itr != end(); ++itr) {
-    bullet_system->CheckForAsteroidHit(itr->entity);
-  }
+  GetSystem<BulletSystem>()->CheckForAsteroidHits();
 }
 
 void AsteroidSystem::DeclareDependencies() {
 	DependOn<SpriteSystem>(corgi::kExecuteBefore, corgi::kReadWriteAccess, corgi::kAutoAdd);
-	DependOn<TransformSystem>(corgi::kExecuteBefore, corgi::kReadWriteAccess, corgi::kAutoAdd);
+	// After, since it acts on collisions, and they come after transforms.
+	DependOn<TransformSystem>(corgi::kExecuteAfter, corgi::kReadAccess, corgi::kAutoAdd);
   DependOn<PhysicsSystem>(corgi::kExecuteAfter, corgi::kReadWriteAccess, corgi::kAutoAdd);
   DependOn<WallBounceSystem>(corgi::kNoOrderDependency, corgi::kReadAccess, corgi::kAutoAdd);
 
   DependOn<BulletSystem>(corgi::kExecuteAfter, corgi::kNoAccessDependency, corgi::kNoAutoAdd);
-  DependOn<FadeTimerSystem>(corgi::kExecuteAfter, corgi::kReadWriteAccess, corgi::kNoAutoAdd);
+  DependOn<CollisionSystem>(corgi::kExecuteAfter, corgi::kReadWriteAccess, corgi::kAutoAdd);
+  DependOn<ParticleSystem>(corgi::kExecuteAfter, corgi::kReadWriteAccess, corgi::kNoAutoAdd);
 
   SetIsThreadSafe(true);
 }
@@ -43,7 +44,8 @@ void AsteroidSystem::DeclareDependencies() {
 
 void AsteroidSystem::InitEntity(corgi::Entity entity) {
 
-  const char* asteroid_texture = "rsc/asteroid.png";
+  static const TextureHandle asteroid_texture =
+      InternTexture("rsc/asteroid.png");
 
   AsteroidData* asteroid = Data<AsteroidData>(entity);
 
@@ -53,7 +55,7 @@ void AsteroidSystem::InitEntity(corgi::Entity entity) {
   transform->scale = vec2(asteroid->radius * 2.0f, asteroid->radius * 2.0f);
 
   SpriteData* sprite = Data<SpriteData>(entity);
-  PhysicsData* physics = Data<PhysicsData>(entity);
+  auto physics = Data<PhysicsData>(entity);
 
   sprite->size = vec2(1, 1);
   sprite->tint = vec4(0.5f + rnd(), 0.5f + rnd(), 0.5f + rnd(), 1.0f);
@@ -61,6 +63,10 @@ void AsteroidSystem::InitEntity(corgi::Entity entity) {
 
   physics->angular_velocity = quat::FromAngleAxis(rnd() * 0.1f - 0.05f, vec3(0.0f, 0.0f, 1.0f));
   physics->velocity = vec2(rnd() * 1.0f - 0.5f, rnd() * 1.0f - 0.5f);
+
+  ColliderData* collider = Data<ColliderData>(entity);
+  collider->radius = asteroid->radius;
+  collider->layers = kCollisionAsteroids;
 }
 
 void AsteroidSystem::ApplyDamage(corgi::Entity asteroid, float damage) {
@@ -72,26 +78,28 @@ void AsteroidSystem::ApplyDamage(corgi::Entity asteroid, float damage) {
   if (data->hp <= 0) {
     data->hp = 100;
     if (radius > 15.0f) {
-      // Spawn some new asteroids!
+      // Spawn some new asteroids!  (They're created at the end of the
+      // frame, so everything they need from this one is copied now.)
+      vec3 position = transform->position;
       for (int i = 0; i < 3; i++) {
-        corgi::Entity new_asteroid = entity_manager_->AllocateNewEntity();
-        entity_manager_->AddComponent<AsteroidSystem>(new_asteroid);
-
-        // Pointers to data are not guaranteed to be valid,
-        // an entity allocation, or component assignment, so we
-        // need to fetch these again:
-        transform = Data<TransformData>(asteroid);
-
         float new_radius = (rnd() * 0.25f + 0.4f) * radius;
-        AsteroidData* new_asteroid_data = Data<AsteroidData>(new_asteroid);
-        new_asteroid_data->radius = new_radius;
-        new_asteroid_data->hp = new_radius * kHpScale;
-        TransformData* new_transform = Data<TransformData>(new_asteroid);
-        new_transform->scale = vec2(new_asteroid_data->radius * 2.0f, new_asteroid_data->radius * 2.0f);
-        new_transform->position = transform->position;
-
-        Data<PhysicsData>(new_asteroid)->velocity = vec2(
+        vec2 velocity = vec2(
           rnd() * (100.0f / new_radius), rnd() * (100.0f / new_radius));
+
+        entity_manager_->commands()->CreateEntity(
+            [this, position, new_radius, velocity](corgi::Entity new_asteroid) {
+          entity_manager_->AddComponent<AsteroidSystem>(new_asteroid);
+
+          AsteroidData* new_asteroid_data = Data<AsteroidData>(new_asteroid);
+          new_asteroid_data->radius = new_radius;
+          new_asteroid_data->hp = new_radius * kHpScale;
+          Data<ColliderData>(new_asteroid)->radius = new_radius;
+          TransformData* new_transform = Data<TransformData>(new_asteroid);
+          new_transform->scale = vec2(new_radius * 2.0f, new_radius * 2.0f);
+          new_transform->position = position;
+
+          Data<PhysicsData>(new_asteroid)->velocity = velocity;
+        });
       }
     }
     for (int i = 0; i < 2 + (radius * radius) / 100; i++) {
@@ -102,35 +110,18 @@ void AsteroidSystem::ApplyDamage(corgi::Entity asteroid, float damage) {
 }
 
 void AsteroidSystem::SpawnDebris(corgi::Entity source) {
-  const char* texture_path = "rsc/asteroid.png";
-  corgi::Entity debris = entity_manager_->AllocateNewEntity();
-  entity_manager_->AddComponent<SpriteSystem>(debris);
-  entity_manager_->AddComponent<FadeTimerSystem>(debris);
-  entity_manager_->AddComponent<PhysicsSystem>(debris);
-
-  SpriteData* sprite_data = Data<SpriteData>(debris);
-  FadeTimerData* fade_data = Data<FadeTimerData>(debris);
-  PhysicsData* physics_data = Data<PhysicsData>(debris);
-  TransformData* transform_data = Data<TransformData>(debris);
-
   AsteroidData* asteroid_data = Data<AsteroidData>(source);
   SpriteData* source_sprite = Data<SpriteData>(source);
   TransformData* source_transform = Data<TransformData>(source);
 
-  sprite_data->size = vec2(20, 20);
-  transform_data->origin = vec2(10, 10);
-
   float radius = asteroid_data->radius;
-  transform_data->position = source_transform->position +
+  vec3 position = source_transform->position +
     quat::FromAngleAxis(rnd() * M_PI, vec3(0, 0, 1)) *
     vec3(0, rnd() * radius, 0);
-  transform_data->position.z() = kLayerParticles;
-
-  sprite_data->tint = source_sprite->tint;
-  sprite_data->texture = texture_path;
-
-  fade_data->counter = 100.0f + 50.0 * rnd();
-  fade_data->fade_point = 100.0f;
-  physics_data->velocity = vec2(rnd() * 5.0f - 2.5f, rnd() * 5.0f - 2.5f);
+  vec4 tint = source_sprite->tint;
+  float counter = 100.0f + 50.0f * rnd();
+  vec2 velocity = vec2(rnd() * 5.0f - 2.5f, rnd() * 5.0f - 2.5f);
 
+  GetSystem<ParticleSystem>()->pool(kDebrisParticles)->Spawn(
+      position.xy(), velocity, 20.0f, tint, counter, 100.0f);
 }
@@ -7,6 +7,7 @@ const float kHpScale = 1.0f;
 const float kBaseAsteroidSize = 75.0f;
 
 struct AsteroidData {
+  // Collisions go by the ColliderData radius, so change both together.
   float radius = kBaseAsteroidSize;
   float hp = kBaseAsteroidSize * kHpScale;
 };
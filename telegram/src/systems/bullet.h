@@ -2,17 +2,12 @@
 #define BULLET_H
 #include "corgi/system.h"
 #include "math_common.h"
-#include <unordered_set>
 #include "constants.h"
+#include "collision.h"
 
 struct BulletData {
 };
 
-const float kBucketSize = 20.0f;
-
-const int kBucketColumns = 1 + (int)(kScreenWidth / 20.0f);
-const int kBucketRows = 1 + (int)(kScreenHeight / 20.0f);
-
 const float kBulletRadius = 2.5f;
 const float kBulletDamage = 2.0f;
 
@@ -25,16 +20,16 @@ public:
   virtual void InitEntity(corgi::Entity entity);
   virtual void CleanupEntity(corgi::Entity entity);
 
-  // Checks to see if an asteroid has been hit.  If so,
-  // returns the bullet that hit it.
-  void CheckForAsteroidHit(corgi::Entity asteroid);
+  // Checks to see if any asteroids have been hit.  Each bullet that hit
+  // one damages it and is used up.  (The hits are found in parallel, and
+  // then dealt with in entity order, so the outcome is the same for any
+  // number of threads.)
+  void CheckForAsteroidHits();
 
   void SpawnHitSparks(corgi::Entity bullet);
 
 private:
-  std::unordered_set<corgi::Entity> collision_map[kBucketRows * kBucketColumns];
-  int BulletSystem::GetBucketIndex(vec2 position);
-
+  std::vector<CollisionPair> hits_;
 };
 
 CORGI_REGISTER_SYSTEM(BulletSystem, BulletData)
@@ -0,0 +1,176 @@
+#include <SDL.h>
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+#include "collision.h"
+#include "constants.h"
+#include "physics.h"
+#include "wallbounce.h"
+
+
+CORGI_DEFINE_SYSTEM(CollisionSystem, ColliderData)
+
+const float kDefaultCellSize = 32.0f;
+
+CollisionSystem::CollisionSystem()
+    : cell_size_(kDefaultCellSize),
+      inverse_cell_size_(1.0f / kDefaultCellSize),
+      columns_(0),
+      rows_(0) {
+  std::fill(max_reach_, max_reach_ + kMaxCollisionLayers, 0.0f);
+}
+
+void CollisionSystem::Init() {
+  SetBounds(vec2(0, 0), vec2(kScreenWidth, kScreenHeight), kDefaultCellSize);
+}
+
+void CollisionSystem::SetBounds(vec2 min, vec2 max, float cell_size) {
+  bounds_min_ = min;
+  bounds_max_ = max;
+  cell_size_ = cell_size;
+  inverse_cell_size_ = 1.0f / cell_size;
+  columns_ = std::max(1, static_cast<int>(ceilf((max.x() - min.x()) *
+      inverse_cell_size_)));
+  rows_ = std::max(1, static_cast<int>(ceilf((max.y() - min.y()) *
+      inverse_cell_size_)));
+
+  colliders_.clear();
+  cell_start_.assign(columns_ * rows_, 0);
+  cell_count_.assign(columns_ * rows_, 0);
+  cell_cursor_.resize(columns_ * rows_);
+}
+
+void CollisionSystem::UpdateAllEntities(corgi::WorldTime delta_time) {
+  query_.Update(entity_manager_);
+  size_t count = query_.size();
+  const corgi::Entity* entities = query_.Entities();
+  ColliderData* const* collider_data = query_.Column<ColliderData>();
+  TransformData* const* transforms = query_.Column<TransformData>();
+
+  // Count how many colliders land in each cell...
+  std::fill(cell_count_.begin(), cell_count_.end(), 0);
+  std::fill(max_reach_, max_reach_ + kMaxCollisionLayers, 0.0f);
+  collider_cells_.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    ColliderData* data = collider_data[i];
+    vec2 position = transforms[i]->world_transform.translation;
+    if (!data->has_previous_position) {
+      data->previous_position = position;
+      data->has_previous_position = true;
+    }
+    uint32_t cell = GetCell(position);
+    collider_cells_[i] = cell;
+    cell_count_[cell]++;
+
+    float reach = data->radius + (position - data->previous_position).Length();
+    uint32_t layers = data->layers;
+    for (int layer = 0; layers != 0; layer++, layers >>= 1) {
+      if ((layers & 1) && reach > max_reach_[layer]) {
+        max_reach_[layer] = reach;
+      }
+    }
+  }
+
+  // ...which gives where each cell starts...
+  uint32_t start = 0;
+  for (size_t cell = 0; cell < cell_start_.size(); cell++) {
+    cell_start_[cell] = start;
+    cell_cursor_[cell] = start;
+    start += cell_count_[cell];
+  }
+
+  // ...and then everything is copied into place.
+  colliders_.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    ColliderData* data = collider_data[i];
+    Collider& collider = colliders_[cell_cursor_[collider_cells_[i]]++];
+    collider.entity = entities[i];
+    collider.position = transforms[i]->world_transform.translation;
+    collider.previous_position = data->previous_position;
+    collider.radius = data->radius;
+    collider.layers = data->layers;
+    // Where the next sweep starts.
+    data->previous_position = collider.position;
+  }
+}
+
+void CollisionSystem::FindPairs(uint32_t layers_a, uint32_t layers_b,
+    std::vector<CollisionPair>* pairs) {
+  corgi::JobPool* job_pool = entity_manager_->job_pool();
+  thread_pairs_.resize(job_pool->thread_count());
+  for (size_t i = 0; i < thread_pairs_.size(); i++) {
+    thread_pairs_[i].clear();
+  }
+
+  ParallelFor(cell_start_.size(), [&](size_t begin, size_t end) {
+    int thread_index = job_pool->CurrentThreadIndex();
+    assert(thread_index >= 0);
+    std::vector<CollisionPair>& found = thread_pairs_[thread_index];
+    for (size_t cell = begin; cell < end; cell++) {
+      const Collider* a = colliders_.data() + cell_start_[cell];
+      const Collider* cell_end = a + cell_count_[cell];
+      for (; a != cell_end; ++a) {
+        if (!(a->layers & layers_a)) continue;
+        ForEachPartner(*a, layers_a, layers_b,
+            [&](const Collider& first, const Collider& second) {
+          CollisionPair pair = {first, second};
+          found.push_back(pair);
+        });
+      }
+    }
+  });
+
+  pairs->clear();
+  for (size_t i = 0; i < thread_pairs_.size(); i++) {
+    pairs->insert(pairs->end(), thread_pairs_[i].begin(),
+        thread_pairs_[i].end());
+  }
+  std::sort(pairs->begin(), pairs->end(),
+      [](const CollisionPair& x, const CollisionPair& y) {
+    return x.a.entity != y.a.entity ? x.a.entity < y.a.entity :
+        x.b.entity < y.b.entity;
+  });
+}
+
+void CollisionSystem::DeclareDependencies() {
+  // Positions are final once these have run, and TransformSystem has
+  // turned them into world positions, parents and all.
+  DependOn<PhysicsSystem>(corgi::kExecuteAfter,
+      corgi::kNoAccessDependency, corgi::kNoAutoAdd);
+  DependOn<WallBounceSystem>(corgi::kExecuteAfter,
+      corgi::kNoAccessDependency, corgi::kNoAutoAdd);
+  DependOn<TransformSystem>(corgi::kExecuteAfter,
+      corgi::kReadAccess, corgi::kAutoAdd);
+  SetIsThreadSafe(true);
+  // For FindPairs, in cells.
+  SetParallelChunkSize(32);
+}
+
+int CollisionSystem::GetCell(vec2 position) const {
+  int left, top, right, bottom;
+  GetCellRange(position, position, &left, &top, &right, &bottom);
+  return left + top * columns_;
+}
+
+void CollisionSystem::GetCellRange(vec2 min, vec2 max, int* left, int* top,
+    int* right, int* bottom) const {
+  // Clamped in float first, so points far outside can't overflow the int.
+  vec2 limit = vec2(static_cast<float>(columns_ - 1),
+      static_cast<float>(rows_ - 1));
+  vec2 low = vec2::Max(vec2(0, 0), vec2::Min(limit,
+      (min - bounds_min_) * inverse_cell_size_));
+  vec2 high = vec2::Max(vec2(0, 0), vec2::Min(limit,
+      (max - bounds_min_) * inverse_cell_size_));
+  *left = static_cast<int>(low.x());
+  *top = static_cast<int>(low.y());
+  *right = static_cast<int>(high.x());
+  *bottom = static_cast<int>(high.y());
+}
+
+float CollisionSystem::MaxReach(uint32_t layers) const {
+  float max_reach = 0.0f;
+  for (int layer = 0; layers != 0; layer++, layers >>= 1) {
+    if (layers & 1) max_reach = std::max(max_reach, max_reach_[layer]);
+  }
+  return max_reach;
+}
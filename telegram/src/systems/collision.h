@@ -0,0 +1,199 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+#include <stdint.h>
+#include <vector>
+#include "corgi/system.h"
+#include "corgi/query.h"
+#include "math_common.h"
+#include "transform.h"
+
+// Which kinds of thing a collider is.  Queries take a mask of these, and
+// only see colliders in at least one of them.
+enum CollisionLayer {
+  kCollisionBullets   = 1 << 0,
+  kCollisionAsteroids = 1 << 1,
+  kCollisionShips     = 1 << 2,
+};
+
+const int kMaxCollisionLayers = 32;
+
+// A circle, centred on the entity's world position, parents and all.
+struct ColliderData {
+  float radius = 0.0f;
+  uint32_t layers = 0;
+
+  // Kept by CollisionSystem:  the position at its last update.
+  vec2 previous_position;
+  bool has_previous_position = false;
+};
+
+// One collider, as of the last update.  The positions are copied in, so a
+// query never has to go back to the transform.
+//
+// Colliders are swept:  each one is tested along the whole straight path
+// from previous_position to position, not just where it ended up, so fast
+// things (bullets) can't skip over small things between frames.
+struct Collider {
+  corgi::Entity entity;
+  vec2 position;
+  vec2 previous_position;
+  float radius;
+  uint32_t layers;
+};
+
+// Whether two circles, moving in straight lines from start to end over the
+// same frame, touch at any point along the way.  (Their offset from each
+// other also moves in a straight line, so this is the closest point on that
+// line to zero.)  If neither moves, it's a plain overlap test.
+inline bool SweptCirclesOverlap(vec2 start_a, vec2 end_a, vec2 start_b,
+    vec2 end_b, float radius) {
+  vec2 offset = start_b - start_a;
+  vec2 motion = (end_b - end_a) - offset;
+  float motion_squared = motion.x() * motion.x() + motion.y() * motion.y();
+  if (motion_squared > 0.0f) {
+    float t = -(offset.x() * motion.x() + offset.y() * motion.y()) /
+        motion_squared;
+    if (t > 1.0f) t = 1.0f;
+    if (t > 0.0f) offset += motion * t;
+  }
+  return offset.x() * offset.x() + offset.y() * offset.y() < radius * radius;
+}
+
+// An overlapping pair, as found by CollisionSystem::FindPairs.
+struct CollisionPair {
+  Collider a;
+  Collider b;
+};
+
+// A uniform grid over every collider, rebuilt each update, that any system
+// can query for overlapping circles.
+//
+// The grid is flat:  the colliders are counting-sorted by cell into one
+// array, and each cell is a start and a count into it.  A collider goes in
+// the cell its centre is in.  (Or the nearest one, if it's outside the
+// bounds, so nothing is ever missed, just slower to find.)
+//
+// Systems that query it should execute after it, so they see this frame's
+// positions.
+class CollisionSystem : public corgi::System<ColliderData> {
+public:
+  CollisionSystem();
+
+  virtual void Init();
+  virtual void UpdateAllEntities(corgi::WorldTime delta_time);
+  virtual void DeclareDependencies();
+
+  // The area the grid covers, and how big its cells are.  Defaults to the
+  // screen.  The grid is empty again until the next update.
+  void SetBounds(vec2 min, vec2 max, float cell_size);
+
+  // Calls fn(const Collider&) for each collider, in any of layers, that
+  // overlaps the circle.  Cells are visited in order, and colliders within
+  // a cell in the order they were added, so results are deterministic.
+  template <typename Fn>
+  void QueryCircle(vec2 center, float radius, uint32_t layers,
+      const Fn& fn) const {
+    QuerySweptCircle(center, center, radius, layers, fn);
+  }
+
+  // Like QueryCircle, for a circle moving from start to end over the frame.
+  template <typename Fn>
+  void QuerySweptCircle(vec2 start, vec2 end, float radius, uint32_t layers,
+      const Fn& fn) const {
+    // Colliders are filed by where they ended up, so look as far out as any
+    // of them could have come from.
+    float reach = radius + MaxReach(layers);
+    int left, top, right, bottom;
+    GetCellRange(vec2::Min(start, end) - vec2(reach, reach),
+        vec2::Max(start, end) + vec2(reach, reach),
+        &left, &top, &right, &bottom);
+    for (int y = top; y <= bottom; y++) {
+      for (int x = left; x <= right; x++) {
+        int cell = x + y * columns_;
+        const Collider* collider = colliders_.data() + cell_start_[cell];
+        const Collider* cell_end = collider + cell_count_[cell];
+        for (; collider != cell_end; ++collider) {
+          if (!(collider->layers & layers)) continue;
+          if (SweptCirclesOverlap(start, end, collider->previous_position,
+              collider->position, radius + collider->radius)) {
+            fn(*collider);
+          }
+        }
+      }
+    }
+  }
+
+  // Calls fn(const Collider& a, const Collider& b) for each overlapping
+  // pair with a in layers_a and b in layers_b.  Each pair comes up once,
+  // even if both masks include both colliders (asteroid against asteroid,
+  // say), and nothing is paired with itself.
+  template <typename Fn>
+  void ForEachPair(uint32_t layers_a, uint32_t layers_b, const Fn& fn) const {
+    for (size_t i = 0; i < colliders_.size(); i++) {
+      if (colliders_[i].layers & layers_a) {
+        ForEachPartner(colliders_[i], layers_a, layers_b, fn);
+      }
+    }
+  }
+
+  // The same pairs as ForEachPair, but found in parallel, a range of cells
+  // per job, and sorted by a's entity and then b's.  So the order doesn't
+  // depend on the thread count, and the caller can act on them in turn.
+  //
+  // Uses scratch space in the system, so callers must declare write access
+  // to ColliderData, which keeps any two of them from running at once.
+  void FindPairs(uint32_t layers_a, uint32_t layers_b,
+      std::vector<CollisionPair>* pairs);
+
+  size_t collider_count() const { return colliders_.size(); }
+
+private:
+  // Calls fn(a, b) for each b that ForEachPair would pair with a.
+  template <typename Fn>
+  void ForEachPartner(const Collider& a, uint32_t layers_a, uint32_t layers_b,
+      const Fn& fn) const {
+    bool a_in_b = (a.layers & layers_b) != 0;
+    QuerySweptCircle(a.previous_position, a.position, a.radius, layers_b,
+        [&](const Collider& b) {
+      if (b.entity == a.entity) return;
+      // Both ways round would match, so only take it the one way.
+      if (a_in_b && (b.layers & layers_a) && b.entity < a.entity) return;
+      fn(a, b);
+    });
+  }
+
+  int GetCell(vec2 position) const;
+  void GetCellRange(vec2 min, vec2 max, int* left, int* top, int* right,
+      int* bottom) const;
+  float MaxReach(uint32_t layers) const;
+
+  corgi::Query<ColliderData, TransformData> query_;
+
+  vec2 bounds_min_;
+  vec2 bounds_max_;
+  float cell_size_;
+  float inverse_cell_size_;
+  int columns_;
+  int rows_;
+
+  // Sorted by cell.  Cell c is colliders_[cell_start_[c]] onwards, for
+  // cell_count_[c] colliders.
+  std::vector<Collider> colliders_;
+  std::vector<uint32_t> cell_start_;
+  std::vector<uint32_t> cell_count_;
+  // Scratch for the sort:  each collider's cell, and where the next
+  // collider in each cell goes.
+  std::vector<uint32_t> collider_cells_;
+  std::vector<uint32_t> cell_cursor_;
+  // FindPairs' output, one list per job pool thread.
+  std::vector<std::vector<CollisionPair>> thread_pairs_;
+
+  // The furthest any collider in each layer reaches from its cell:  its
+  // radius, plus how far it moved.  So queries know how far out to look.
+  float max_reach_[kMaxCollisionLayers];
+};
+
+CORGI_REGISTER_SYSTEM(CollisionSystem, ColliderData)
+
+
+#endif // COLLISION_H
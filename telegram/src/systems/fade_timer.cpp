@@ -4,10 +4,13 @@
 CORGI_DEFINE_SYSTEM(FadeTimerSystem, FadeTimerData)
 
 void FadeTimerSystem::UpdateAllEntities(corgi::WorldTime delta_time) {
-  for (auto itr = begin(); itr != end(); ++itr) {
-    corgi::Entity entity = itr->entity;
-    SpriteData* sprite = Data<SpriteData>(entity);
-    FadeTimerData* fade_data = Data<FadeTimerData>(entity);
+  query_.Update(entity_manager_);
+  FadeTimerData* const* fade_timers = query_.Column<FadeTimerData>();
+  SpriteData* const* sprites = query_.Column<SpriteData>();
+  for (size_t i = 0; i < query_.size(); i++) {
+    corgi::Entity entity = query_.entity(i);
+    SpriteData* sprite = sprites[i];
+    FadeTimerData* fade_data = fade_timers[i];
 
     fade_data->counter -= delta_time;
     if (fade_data->counter < fade_data->fade_point) {
@@ -1,6 +1,8 @@
 #ifndef FADE_TIMER_H
 #define FADE_TIMER_H
+#include "corgi/query.h"
 #include "corgi/system.h"
+#include "sprite.h"
 
 struct FadeTimerData {
   corgi::WorldTime counter;
@@ -14,6 +16,9 @@ public:
   virtual void UpdateAllEntities(corgi::WorldTime delta_time);
 
   virtual void DeclareDependencies();
+
+private:
+  corgi::Query<FadeTimerData, SpriteData> query_;
 };
 
 CORGI_REGISTER_SYSTEM(FadeTimerSystem, FadeTimerData)
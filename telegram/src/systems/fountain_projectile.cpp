@@ -15,7 +15,7 @@ void FountainProjectile::UpdateAllEntities(corgi::WorldTime delta_time) {
 
 		TransformData* transform = Data<TransformData>(entity);
 		SpriteData* sprite = Data<SpriteData>(entity);
-		PhysicsData* physics = Data<PhysicsData>(entity);
+		auto physics = Data<PhysicsData>(entity);
 
 		transform->scale *= 0.98f;
 		if (transform->scale.x() < 0.1) {
@@ -41,7 +41,7 @@ void FountainProjectile::DeclareDependencies() {
 void FountainProjectile::InitEntity(corgi::Entity entity) {
 	TransformData* transform = Data<TransformData>(entity);
 	SpriteData* sprite = Data<SpriteData>(entity);
-	PhysicsData* physics = Data<PhysicsData>(entity);
+	auto physics = Data<PhysicsData>(entity);
 
 	
 	transform->position = vec3(320, 480, 0);
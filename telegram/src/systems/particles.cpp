@@ -0,0 +1,127 @@
+#include "particles.h"
+#include "constants.h"
+
+#if !defined(TELEGRAM_SCALAR_KERNELS) && (defined(__SSE__) || \
+		defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define PARTICLES_SSE
+#include <xmmintrin.h>
+#endif
+
+
+CORGI_DEFINE_SYSTEM(ParticleSystem, ParticleData)
+
+// Pools are sized for the most the benchmark asks for.  (The game itself
+// rarely has more than a few hundred of each.)
+struct EmitterInfo {
+  const char* texture;
+  size_t capacity;
+};
+
+static const EmitterInfo kEmitters[kParticleEmitterCount] = {
+  { "rsc/circle.png", 32768 },    // kExhaustParticles
+  { "rsc/circle.png", 4096 },     // kSparkParticles
+  { "rsc/asteroid.png", 32768 },  // kDebrisParticles
+};
+
+// Moves each particle by its velocity and runs down its timer, fading it
+// out past its fade point.  Returns how many are still alive.
+static size_t UpdateParticles(float* x, float* y, const float* velocity_x,
+    const float* velocity_y, float* counter, const float* fade_point,
+    float* alpha, float delta_time, size_t count) {
+  size_t live_count = 0;
+  size_t i = 0;
+#ifdef PARTICLES_SSE
+  static const int kBitCount[16] = {
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+  };
+  const __m128 dt = _mm_set1_ps(delta_time);
+  const __m128 zero = _mm_setzero_ps();
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_ps(x + i, _mm_add_ps(_mm_loadu_ps(x + i),
+        _mm_loadu_ps(velocity_x + i)));
+    _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i),
+        _mm_loadu_ps(velocity_y + i)));
+
+    __m128 c = _mm_sub_ps(_mm_loadu_ps(counter + i), dt);
+    __m128 f = _mm_loadu_ps(fade_point + i);
+    __m128 fading = _mm_cmplt_ps(c, f);
+    __m128 a = _mm_or_ps(_mm_and_ps(fading, _mm_div_ps(c, f)),
+        _mm_andnot_ps(fading, _mm_loadu_ps(alpha + i)));
+    _mm_storeu_ps(counter + i, c);
+    _mm_storeu_ps(alpha + i, a);
+
+    live_count += kBitCount[_mm_movemask_ps(_mm_cmpgt_ps(c, zero))];
+  }
+#endif // PARTICLES_SSE
+  for (; i < count; i++) {
+    x[i] += velocity_x[i];
+    y[i] += velocity_y[i];
+    counter[i] -= delta_time;
+    if (counter[i] < fade_point[i]) alpha[i] = counter[i] / fade_point[i];
+    if (counter[i] > 0.0f) live_count++;
+  }
+  return live_count;
+}
+
+ParticlePool::ParticlePool(TextureHandle texture, float depth,
+    size_t capacity)
+    : texture_(texture),
+      depth_(depth),
+      capacity_(capacity),
+      next_slot_(0),
+      slot_count_(0),
+      live_count_(0),
+      x_(capacity),
+      y_(capacity),
+      velocity_x_(capacity),
+      velocity_y_(capacity),
+      counter_(capacity),
+      fade_point_(capacity),
+      alpha_(capacity),
+      half_size_(capacity),
+      tint_(capacity) {}
+
+void ParticlePool::Spawn(vec2 position, vec2 velocity, float size, vec4 tint,
+    float lifetime, float fade_point) {
+  size_t slot = next_slot_;
+  next_slot_ = next_slot_ + 1 < capacity_ ? next_slot_ + 1 : 0;
+  if (slot_count_ <= slot) slot_count_ = slot + 1;
+
+  // Might be replacing a live one, if the pool is full.
+  if (IsLive(slot)) live_count_--;
+  if (lifetime > 0.0f) live_count_++;
+
+  x_[slot] = position.x();
+  y_[slot] = position.y();
+  velocity_x_[slot] = velocity.x();
+  velocity_y_[slot] = velocity.y();
+  counter_[slot] = lifetime;
+  fade_point_[slot] = fade_point;
+  alpha_[slot] = tint.w();
+  half_size_[slot] = size * 0.5f;
+  tint_[slot] = tint;
+}
+
+void ParticlePool::Update(corgi::WorldTime delta_time) {
+  live_count_ = UpdateParticles(x_.data(), y_.data(), velocity_x_.data(),
+      velocity_y_.data(), counter_.data(), fade_point_.data(), alpha_.data(),
+      static_cast<float>(delta_time), slot_count_);
+}
+
+void ParticleSystem::Init() {
+  pools_.clear();
+  for (int i = 0; i < kParticleEmitterCount; i++) {
+    pools_.push_back(ParticlePool(InternTexture(kEmitters[i].texture),
+        kLayerParticles, kEmitters[i].capacity));
+  }
+}
+
+void ParticleSystem::UpdateAllEntities(corgi::WorldTime delta_time) {
+  for (size_t i = 0; i < pools_.size(); i++) {
+    pools_[i].Update(delta_time);
+  }
+}
+
+void ParticleSystem::DeclareDependencies() {
+  SetIsThreadSafe(true);
+}
@@ -0,0 +1,104 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+#include <stddef.h>
+#include <vector>
+#include "corgi/system.h"
+#include "math_common.h"
+#include "texture_handle.h"
+
+// The kinds of particle the game makes.  Each gets a pool of its own.
+enum ParticleEmitter {
+  kExhaustParticles,
+  kSparkParticles,
+  kDebrisParticles,
+  kParticleEmitterCount
+};
+
+// A fixed number of particles that share a texture and a draw layer,
+// stored struct-of-arrays.
+//
+// New particles go in the next slot round, like a ring buffer, so spawning
+// never allocates or searches.  If the pool is full, the oldest particle is
+// replaced.  Dead slots just sit there, skipped, until the ring comes back
+// around to them.
+//
+// Particles are square, unrotated sprites that drift at a constant
+// velocity and fade out, like the sprite + fade timer + physics entities
+// they replace.
+class ParticlePool {
+public:
+  ParticlePool(TextureHandle texture, float depth, size_t capacity);
+
+  // lifetime counts down by delta_time each update.  Once it drops below
+  // fade_point, the alpha is the fraction of fade_point left.
+  void Spawn(vec2 position, vec2 velocity, float size, vec4 tint,
+      float lifetime, float fade_point);
+
+  // Moves every particle and runs down its timer.
+  void Update(corgi::WorldTime delta_time);
+
+  TextureHandle texture() const { return texture_; }
+  float depth() const { return depth_; }
+  size_t capacity() const { return capacity_; }
+  size_t live_count() const { return live_count_; }
+
+  // Slots at or past this have never been used.
+  size_t slot_count() const { return slot_count_; }
+  bool IsLive(size_t slot) const { return counter_[slot] > 0.0f; }
+  vec2 position(size_t slot) const { return vec2(x_[slot], y_[slot]); }
+  float half_size(size_t slot) const { return half_size_[slot]; }
+  // With the faded alpha.
+  vec4 tint(size_t slot) const {
+    return vec4(tint_[slot].x(), tint_[slot].y(), tint_[slot].z(),
+        alpha_[slot]);
+  }
+
+private:
+  TextureHandle texture_;
+  float depth_;
+  size_t capacity_;
+  size_t next_slot_;
+  size_t slot_count_;
+  size_t live_count_;
+
+  // What Update touches:
+  std::vector<float> x_;
+  std::vector<float> y_;
+  std::vector<float> velocity_x_;
+  std::vector<float> velocity_y_;
+  std::vector<float> counter_;
+  std::vector<float> fade_point_;
+  std::vector<float> alpha_;
+  // And what only drawing does:
+  std::vector<float> half_size_;
+  std::vector<vec4> tint_;
+};
+
+// Particles aren't entities, so nothing has this.
+struct ParticleData {
+};
+
+// Owns a ParticlePool per emitter, and updates them.  SpriteSystem draws
+// them straight out of the pools, along with the sprites.
+//
+// Systems that spawn particles should execute after this one, with write
+// access to it.
+class ParticleSystem : public corgi::System<ParticleData> {
+public:
+
+  virtual void Init();
+  virtual void UpdateAllEntities(corgi::WorldTime delta_time);
+  virtual void DeclareDependencies();
+
+  ParticlePool* pool(ParticleEmitter emitter) { return &pools_[emitter]; }
+  size_t pool_count() const { return pools_.size(); }
+  const ParticlePool& pool(size_t index) const { return pools_[index]; }
+
+private:
+  std::vector<ParticlePool> pools_;
+};
+
+CORGI_REGISTER_SYSTEM(ParticleSystem, ParticleData)
+
+
+#endif // PARTICLES_H
@@ -1,5 +1,6 @@
 #include <SDL.h>
 #include "physics.h"
+#include "physics_kernels.h"
 #include "transform.h"
 
 CORGI_DEFINE_SYSTEM(PhysicsSystem, PhysicsData)
@@ -9,23 +10,36 @@ void PhysicsSystem::DeclareDependencies() {
 	DependOn<TransformSystem>(corgi::kExecuteBefore,
       corgi::kReadWriteAccess, corgi::kAutoAdd);
 	SetIsThreadSafe(true);
+	SetParallelChunkSize(256);
 }
 
 
 
 void PhysicsSystem::UpdateAllEntities(corgi::WorldTime delta_time) {
-	for (auto itr = begin(); itr != end(); ++itr) {
-		corgi::Entity entity = itr->entity;
-		TransformData* transform_data = Data<TransformData>(entity);
-		PhysicsData* physics_data = Data<PhysicsData>(entity);
-		transform_data->position += vec3(physics_data->velocity.x(),
-					physics_data->velocity.y(), 0);
-		physics_data->velocity += physics_data->acceleration;
-		//todo - add a max velocity here?
+	query_.Update(entity_manager_);
+	const PhysicsSystem::Pointer* physics = query_.Column<PhysicsData>();
+	TransformData* const* transforms = query_.Column<TransformData>();
+	PhysicsColumns* columns = component_data_.columns();
+	const vec2* velocities = columns->Column<kVelocityColumn>();
+	const quat* angular_velocities = columns->Column<kAngularVelocityColumn>();
+	// Every entity is independent, so this splits across threads.
+	ParallelFor(query_.size(), [=](size_t begin, size_t end) {
+		ApplyVelocities(transforms + begin, physics + begin, velocities,
+				angular_velocities, end - begin);
+	});
 
-		transform_data->orientation =
-  			transform_data->orientation * physics_data->angular_velocity;
-		physics_data->angular_velocity =
-			  physics_data->angular_velocity * physics_data->angular_acceleration;
-	}
+	// Then the physics fields on their own, straight down the arrays.  (Every
+	// entity here has a transform, since it's auto-added, so these are the
+	// same entities as above.)
+	vec2* velocity = columns->Column<kVelocityColumn>();
+	const vec2* acceleration = columns->Column<kAccelerationColumn>();
+	quat* angular_velocity = columns->Column<kAngularVelocityColumn>();
+	const quat* angular_acceleration =
+			columns->Column<kAngularAccelerationColumn>();
+	ParallelFor(ComponentCount(), [=](size_t begin, size_t end) {
+		//todo - add a max velocity here?
+		IntegrateVelocities(velocity + begin, acceleration + begin, end - begin);
+		IntegrateRotations(angular_velocity + begin, angular_acceleration + begin,
+				end - begin);
+	});
 }
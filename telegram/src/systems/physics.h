@@ -1,7 +1,10 @@
 #ifndef PHYSICS_H
 #define PHYSICS_H
+#include "corgi/component_storage.h"
+#include "corgi/query.h"
 #include "corgi/system.h"
 #include "math_common.h"
+#include "transform.h"
 
 struct PhysicsData {
 	PhysicsData()
@@ -16,6 +19,42 @@ struct PhysicsData {
 	quat angular_acceleration;
 };
 
+// Physics data is stored a field per array, so the integration step can
+// stream through just the fields it needs.
+enum PhysicsColumn {
+	kVelocityColumn,
+	kAccelerationColumn,
+	kAngularVelocityColumn,
+	kAngularAccelerationColumn
+};
+
+typedef corgi::SoAColumns<PhysicsData,
+	corgi::SoAField<PhysicsData, vec2, &PhysicsData::velocity>,
+	corgi::SoAField<PhysicsData, vec2, &PhysicsData::acceleration>,
+	corgi::SoAField<PhysicsData, quat, &PhysicsData::angular_velocity>,
+	corgi::SoAField<PhysicsData, quat, &PhysicsData::angular_acceleration>>
+	PhysicsColumns;
+
+// One entity's fields, as Data<PhysicsData>(entity)->velocity and so on
+// see them.
+struct PhysicsDataRef {
+	PhysicsDataRef(PhysicsColumns& columns, size_t index)
+		: velocity(columns.Column<kVelocityColumn>()[index]),
+		acceleration(columns.Column<kAccelerationColumn>()[index]),
+		angular_velocity(columns.Column<kAngularVelocityColumn>()[index]),
+		angular_acceleration(
+			columns.Column<kAngularAccelerationColumn>()[index]) {}
+
+	PhysicsDataRef* operator->() { return this; }
+
+	vec2& velocity;
+	vec2& acceleration;
+	quat& angular_velocity;
+	quat& angular_acceleration;
+};
+
+CORGI_SOA_STORAGE(PhysicsData, PhysicsColumns, PhysicsDataRef)
+
 
 class PhysicsSystem : public corgi::System<PhysicsData> {
 public:
@@ -24,6 +63,14 @@ public:
 
   virtual void DeclareDependencies();
 
+  // The velocity column, indexed by a physics Pointer's index().  For batch
+  // kernels in other systems.
+  vec2* velocities() {
+    return component_data_.columns()->Column<kVelocityColumn>();
+  }
+
+private:
+  corgi::Query<PhysicsData, TransformData> query_;
 };
 
 CORGI_REGISTER_SYSTEM(PhysicsSystem, PhysicsData)
@@ -0,0 +1,256 @@
+#include "physics_kernels.h"
+
+#if !defined(TELEGRAM_SCALAR_KERNELS) && (defined(__SSE__) || \
+		defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define PHYSICS_KERNELS_SSE
+#include <xmmintrin.h>
+#endif
+
+// The SSE paths load these straight out of memory, as packed floats.
+static_assert(sizeof(vec2) == 2 * sizeof(float), "vec2 must be packed");
+static_assert(sizeof(quat) == 4 * sizeof(float), "quat must be packed");
+
+// The scalar versions, one entity at a time.  These are the reference:
+// exactly what the systems used to do inline.
+
+// Whether applying these would change anything.  (Entities at rest keep
+// their cached world transforms.)
+static bool Moves(const vec2& velocity, const quat& angular_velocity) {
+	const vec3& spin = angular_velocity.vector();
+	return velocity.x() != 0 || velocity.y() != 0 ||
+			angular_velocity.scalar() != 1 ||
+			spin.x() != 0 || spin.y() != 0 || spin.z() != 0;
+}
+
+static void ApplyVelocity(TransformData* transform, const vec2& velocity,
+		const quat& angular_velocity) {
+	transform->position += vec3(velocity.x(), velocity.y(), 0);
+	transform->orientation = transform->orientation * angular_velocity;
+	if (Moves(velocity, angular_velocity)) transform->dirty = true;
+}
+
+static void BounceOffWalls(TransformData* transform, vec2& velocity,
+		const vec2& screen_size) {
+	if (transform->position.x() < 0) {
+		transform->position.x() = 0;
+		transform->dirty = true;
+		if (velocity.x() < 0) velocity.x() *= -1;
+	}
+	if (transform->position.y() < 0) {
+		transform->position.y() = 0;
+		transform->dirty = true;
+		if (velocity.y() < 0) velocity.y() *= -1;
+	}
+	if (transform->position.x() >= screen_size.x()) {
+		transform->position.x() = screen_size.x() - 1.0f;
+		transform->dirty = true;
+		if (velocity.x() > 0) velocity.x() *= -1;
+	}
+	if (transform->position.y() >= screen_size.y()) {
+		transform->position.y() = screen_size.y() - 1.0f;
+		transform->dirty = true;
+		if (velocity.y() > 0) velocity.y() *= -1;
+	}
+}
+
+#ifdef PHYSICS_KERNELS_SSE
+
+// Four quaternion products at once, with the quaternions transposed into
+// one register per component.  Mirrors mathfu's operator*:
+//   s = as * bs - dot(av, bv)
+//   v = as * bv + bs * av + cross(av, bv)
+static void MultiplyQuats(__m128& as, __m128& ax, __m128& ay, __m128& az,
+		__m128 bs, __m128 bx, __m128 by, __m128 bz) {
+	__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+			_mm_mul_ps(az, bz));
+	__m128 s = _mm_sub_ps(_mm_mul_ps(as, bs), dot);
+	__m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(as, bx), _mm_mul_ps(bs, ax)),
+			_mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by)));
+	__m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(as, by), _mm_mul_ps(bs, ay)),
+			_mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(ax, bz)));
+	__m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(as, bz), _mm_mul_ps(bs, az)),
+			_mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx)));
+	as = s;
+	ax = x;
+	ay = y;
+	az = z;
+}
+
+// mask ? a : b, lane by lane.
+static __m128 Select(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// One axis of BounceOffWalls, for four entities.
+static void BounceOffWalls(__m128& position, __m128& velocity,
+		__m128 screen_size, __m128 far_edge) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 flip = _mm_set1_ps(-1.0f);
+	__m128 hit = _mm_cmplt_ps(position, zero);
+	position = Select(hit, zero, position);
+	velocity = Select(_mm_and_ps(hit, _mm_cmplt_ps(velocity, zero)),
+			_mm_mul_ps(velocity, flip), velocity);
+	hit = _mm_cmpge_ps(position, screen_size);
+	position = Select(hit, far_edge, position);
+	velocity = Select(_mm_and_ps(hit, _mm_cmpgt_ps(velocity, zero)),
+			_mm_mul_ps(velocity, flip), velocity);
+}
+
+#endif // PHYSICS_KERNELS_SSE
+
+void IntegrateVelocities(vec2* velocities, const vec2* accelerations,
+		size_t count) {
+	size_t i = 0;
+#ifdef PHYSICS_KERNELS_SSE
+	// Two vec2s per register, so two registers' worth per step.
+	float* v = reinterpret_cast<float*>(velocities);
+	const float* a = reinterpret_cast<const float*>(accelerations);
+	for (; i + 4 <= count; i += 4) {
+		__m128 v0 = _mm_add_ps(_mm_loadu_ps(v + 2 * i),
+				_mm_loadu_ps(a + 2 * i));
+		__m128 v1 = _mm_add_ps(_mm_loadu_ps(v + 2 * i + 4),
+				_mm_loadu_ps(a + 2 * i + 4));
+		_mm_storeu_ps(v + 2 * i, v0);
+		_mm_storeu_ps(v + 2 * i + 4, v1);
+	}
+#endif // PHYSICS_KERNELS_SSE
+	for (; i < count; i++) {
+		velocities[i] += accelerations[i];
+	}
+}
+
+void IntegrateRotations(quat* rotations, const quat* spins, size_t count) {
+	size_t i = 0;
+#ifdef PHYSICS_KERNELS_SSE
+	float* r = reinterpret_cast<float*>(rotations);
+	const float* s = reinterpret_cast<const float*>(spins);
+	for (; i + 4 <= count; i += 4) {
+		__m128 as = _mm_loadu_ps(r + 4 * i);
+		__m128 ax = _mm_loadu_ps(r + 4 * i + 4);
+		__m128 ay = _mm_loadu_ps(r + 4 * i + 8);
+		__m128 az = _mm_loadu_ps(r + 4 * i + 12);
+		__m128 bs = _mm_loadu_ps(s + 4 * i);
+		__m128 bx = _mm_loadu_ps(s + 4 * i + 4);
+		__m128 by = _mm_loadu_ps(s + 4 * i + 8);
+		__m128 bz = _mm_loadu_ps(s + 4 * i + 12);
+		_MM_TRANSPOSE4_PS(as, ax, ay, az);
+		_MM_TRANSPOSE4_PS(bs, bx, by, bz);
+		MultiplyQuats(as, ax, ay, az, bs, bx, by, bz);
+		_MM_TRANSPOSE4_PS(as, ax, ay, az);
+		_mm_storeu_ps(r + 4 * i, as);
+		_mm_storeu_ps(r + 4 * i + 4, ax);
+		_mm_storeu_ps(r + 4 * i + 8, ay);
+		_mm_storeu_ps(r + 4 * i + 12, az);
+	}
+#endif // PHYSICS_KERNELS_SSE
+	for (; i < count; i++) {
+		rotations[i] = rotations[i] * spins[i];
+	}
+}
+
+void ApplyVelocities(TransformData* const* transforms,
+		const PhysicsSystem::Pointer* physics, const vec2* velocities,
+		const quat* angular_velocities, size_t count) {
+	size_t i = 0;
+#ifdef PHYSICS_KERNELS_SSE
+	// The orientations are scattered, so they're gathered four at a time
+	// for the products.  Positions stay scalar:  only x and y move, and
+	// there's no spare lane past z to pad them out with.
+	for (; i + 4 <= count; i += 4) {
+		TransformData* t0 = transforms[i];
+		TransformData* t1 = transforms[i + 1];
+		TransformData* t2 = transforms[i + 2];
+		TransformData* t3 = transforms[i + 3];
+		size_t p0 = physics[i].index();
+		size_t p1 = physics[i + 1].index();
+		size_t p2 = physics[i + 2].index();
+		size_t p3 = physics[i + 3].index();
+
+		__m128 as = _mm_loadu_ps(&t0->orientation[0]);
+		__m128 ax = _mm_loadu_ps(&t1->orientation[0]);
+		__m128 ay = _mm_loadu_ps(&t2->orientation[0]);
+		__m128 az = _mm_loadu_ps(&t3->orientation[0]);
+		__m128 bs = _mm_loadu_ps(&angular_velocities[p0][0]);
+		__m128 bx = _mm_loadu_ps(&angular_velocities[p1][0]);
+		__m128 by = _mm_loadu_ps(&angular_velocities[p2][0]);
+		__m128 bz = _mm_loadu_ps(&angular_velocities[p3][0]);
+		_MM_TRANSPOSE4_PS(as, ax, ay, az);
+		_MM_TRANSPOSE4_PS(bs, bx, by, bz);
+		MultiplyQuats(as, ax, ay, az, bs, bx, by, bz);
+		_MM_TRANSPOSE4_PS(as, ax, ay, az);
+		_mm_storeu_ps(&t0->orientation[0], as);
+		_mm_storeu_ps(&t1->orientation[0], ax);
+		_mm_storeu_ps(&t2->orientation[0], ay);
+		_mm_storeu_ps(&t3->orientation[0], az);
+
+		t0->position += vec3(velocities[p0].x(), velocities[p0].y(), 0);
+		t1->position += vec3(velocities[p1].x(), velocities[p1].y(), 0);
+		t2->position += vec3(velocities[p2].x(), velocities[p2].y(), 0);
+		t3->position += vec3(velocities[p3].x(), velocities[p3].y(), 0);
+		if (Moves(velocities[p0], angular_velocities[p0])) t0->dirty = true;
+		if (Moves(velocities[p1], angular_velocities[p1])) t1->dirty = true;
+		if (Moves(velocities[p2], angular_velocities[p2])) t2->dirty = true;
+		if (Moves(velocities[p3], angular_velocities[p3])) t3->dirty = true;
+	}
+#endif // PHYSICS_KERNELS_SSE
+	for (; i < count; i++) {
+		size_t index = physics[i].index();
+		ApplyVelocity(transforms[i], velocities[index],
+				angular_velocities[index]);
+	}
+}
+
+void BounceOffWalls(TransformData* const* transforms,
+		const PhysicsSystem::Pointer* physics, vec2* velocities,
+		vec2 screen_size, size_t count) {
+	size_t i = 0;
+#ifdef PHYSICS_KERNELS_SSE
+	const __m128 width = _mm_set1_ps(screen_size.x());
+	const __m128 height = _mm_set1_ps(screen_size.y());
+	const __m128 right = _mm_set1_ps(screen_size.x() - 1.0f);
+	const __m128 bottom = _mm_set1_ps(screen_size.y() - 1.0f);
+	const __m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= count; i += 4) {
+		TransformData* t[4] = {transforms[i], transforms[i + 1],
+				transforms[i + 2], transforms[i + 3]};
+		__m128 x = _mm_setr_ps(t[0]->position.x(), t[1]->position.x(),
+				t[2]->position.x(), t[3]->position.x());
+		__m128 y = _mm_setr_ps(t[0]->position.y(), t[1]->position.y(),
+				t[2]->position.y(), t[3]->position.y());
+
+		// Nearly everything is on screen, so test for that first, and skip
+		// the velocity gather entirely.
+		__m128 outside = _mm_or_ps(
+				_mm_or_ps(_mm_cmplt_ps(x, zero), _mm_cmpge_ps(x, width)),
+				_mm_or_ps(_mm_cmplt_ps(y, zero), _mm_cmpge_ps(y, height)));
+		int outside_mask = _mm_movemask_ps(outside);
+		if (outside_mask == 0) continue;
+
+		vec2* v[4] = {&velocities[physics[i].index()],
+				&velocities[physics[i + 1].index()],
+				&velocities[physics[i + 2].index()],
+				&velocities[physics[i + 3].index()]};
+		__m128 vx = _mm_setr_ps(v[0]->x(), v[1]->x(), v[2]->x(), v[3]->x());
+		__m128 vy = _mm_setr_ps(v[0]->y(), v[1]->y(), v[2]->y(), v[3]->y());
+		BounceOffWalls(x, vx, width, right);
+		BounceOffWalls(y, vy, height, bottom);
+
+		float xs[4], ys[4], vxs[4], vys[4];
+		_mm_storeu_ps(xs, x);
+		_mm_storeu_ps(ys, y);
+		_mm_storeu_ps(vxs, vx);
+		_mm_storeu_ps(vys, vy);
+		for (int j = 0; j < 4; j++) {
+			t[j]->position.x() = xs[j];
+			t[j]->position.y() = ys[j];
+			v[j]->x() = vxs[j];
+			v[j]->y() = vys[j];
+			if (outside_mask & (1 << j)) t[j]->dirty = true;
+		}
+	}
+#endif // PHYSICS_KERNELS_SSE
+	for (; i < count; i++) {
+		BounceOffWalls(transforms[i], velocities[physics[i].index()],
+				screen_size);
+	}
+}
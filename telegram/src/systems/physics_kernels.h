@@ -0,0 +1,37 @@
+#ifndef PHYSICS_KERNELS_H
+#define PHYSICS_KERNELS_H
+#include <stddef.h>
+#include "math_common.h"
+#include "physics.h"
+#include "transform.h"
+
+// Batch kernels for the physics and wall bounce updates.
+//
+// Where SSE is available (x86 and x64) they handle four entities per
+// instruction, and elsewhere (or if TELEGRAM_SCALAR_KERNELS is defined)
+// they fall back to plain scalar code.  Both paths do the same float
+// operations, in the same order, as the mathfu code they replace, so the
+// results are bit-identical either way.  (That relies on the compiler not
+// fusing multiplies and adds, which neither does by default.)
+
+// velocities[i] += accelerations[i]
+void IntegrateVelocities(vec2* velocities, const vec2* accelerations,
+		size_t count);
+
+// rotations[i] = rotations[i] * spins[i]
+void IntegrateRotations(quat* rotations, const quat* spins, size_t count);
+
+// Moves and turns each transform by the velocity and angular velocity of
+// its physics row.  (Indexes into the physics columns.)  Marks the ones that
+// actually moved dirty.
+void ApplyVelocities(TransformData* const* transforms,
+		const PhysicsSystem::Pointer* physics, const vec2* velocities,
+		const quat* angular_velocities, size_t count);
+
+// Clamps each transform's position to [0, screen_size), and turns its
+// velocity away from any edge it crossed.  Marks the clamped ones dirty.
+void BounceOffWalls(TransformData* const* transforms,
+		const PhysicsSystem::Pointer* physics, vec2* velocities,
+		vec2 screen_size, size_t count);
+
+#endif // PHYSICS_KERNELS_H
@@ -6,9 +6,10 @@
 #include "wallbounce.h"
 #include <stdio.h>
 #include "common.h"
-#include "fade_timer.h"
+#include "particles.h"
 #include "constants.h"
 #include "bullet.h"
+#include "collision.h"
 
 
 CORGI_DEFINE_SYSTEM(PlayerShip, PlayerShipData)
@@ -20,6 +21,7 @@ const float kMaxSpeed = 5.0f;
 const float kExhaustSpeed = -3.0f;
 const float kBulletSpeed = 10.0f;
 const float kShipDrag = 0.995f;
+const float kShipRadius = 12.0f;
 
 // basic orientation is pointing straight up.
 static const vec3 kBaseOrientation = vec3(0, 1, 0);
@@ -33,7 +35,7 @@ void PlayerShip::UpdateAllEntities(corgi::WorldTime delta_time) {
     // only be only one player.  But who knows what we'll want
     // in the future!
     TransformData* transform = Data<TransformData>(itr->entity);
-    PhysicsData* physics = Data<PhysicsData>(itr->entity);
+    auto physics = Data<PhysicsData>(itr->entity);
     vec3& pos = transform->position;
     quat& rotation = transform->orientation;
     vec2& velocity = physics->velocity;
@@ -41,10 +43,12 @@ void PlayerShip::UpdateAllEntities(corgi::WorldTime delta_time) {
     if (common->keyboard_input->GetKeyState(SDLK_LEFT).is_down ||
       common->keyboard_input->GetKeyState(SDLK_a).is_down) {
       rotation = rotation * quat::FromAngleAxis(-kTurnSpeed, vec3(0, 0, 1));
+      transform->dirty = true;
     }
     if (common->keyboard_input->GetKeyState(SDLK_RIGHT).is_down || 
       common->keyboard_input->GetKeyState(SDLK_d).is_down) {
       rotation = rotation * quat::FromAngleAxis(kTurnSpeed, vec3(0, 0, 1));
+      transform->dirty = true;
     }
     if (common->keyboard_input->GetKeyState(SDLK_UP).is_down ||
       common->keyboard_input->GetKeyState(SDLK_w).is_down) {
@@ -61,49 +65,37 @@ void PlayerShip::UpdateAllEntities(corgi::WorldTime delta_time) {
 
 
 void PlayerShip::FireGun(corgi::Entity ship) {
-  corgi::Entity bullet = entity_manager_->AllocateNewEntity();
-  entity_manager_->AddComponent<BulletSystem>(bullet);
-
   TransformData* ship_transform = Data<TransformData>(ship);
-  TransformData* bullet_transform = Data<TransformData>(bullet);
-  vec2 heading = (ship_transform->orientation * kBaseOrientation).xy().Normalized();
-  heading.y() = -heading.y();
-  bullet_transform->orientation = ship_transform->orientation;
-  bullet_transform->position = ship_transform->position + vec3(heading * 15.0f, 0);
-
-  PhysicsData* bullet_physics = Data<PhysicsData>(bullet);
-  bullet_physics->velocity = heading * kBulletSpeed;
+  quat orientation = ship_transform->orientation;
+  vec3 position = ship_transform->position;
+
+  entity_manager_->commands()->CreateEntity(
+      [this, orientation, position](corgi::Entity bullet) {
+    entity_manager_->AddComponent<BulletSystem>(bullet);
+
+    TransformData* bullet_transform = Data<TransformData>(bullet);
+    vec2 heading = (orientation * kBaseOrientation).xy().Normalized();
+    heading.y() = -heading.y();
+    bullet_transform->orientation = orientation;
+    bullet_transform->position = position + vec3(heading * 15.0f, 0);
+
+    auto bullet_physics = Data<PhysicsData>(bullet);
+    bullet_physics->velocity = heading * kBulletSpeed;
+  });
 }
 
 
 // Makes an exhaust particle trailing behind the ship.
 void PlayerShip::SpawnExhaust(corgi::Entity ship) {
-  const char* texture_path = "rsc/circle.png";
-  corgi::Entity exhaust = entity_manager_->AllocateNewEntity();
-  entity_manager_->AddComponent<SpriteSystem>(exhaust);
-  entity_manager_->AddComponent<FadeTimerSystem>(exhaust);
-  entity_manager_->AddComponent<PhysicsSystem>(exhaust);
-
-  SpriteData* sprite_data = Data<SpriteData>(exhaust);
-  FadeTimerData* fade_data = Data<FadeTimerData>(exhaust);
-  PhysicsData* physics_data = Data<PhysicsData>(exhaust);
-  TransformData* transform_data = Data<TransformData>(exhaust);
-
-  TransformData* ship_transform = Data<TransformData>(ship);
-  vec2 heading = (ship_transform->orientation * kBaseOrientation).xy().Normalized();
-  heading.y() = -heading.y();
-
-  sprite_data->size = vec2(10, 10);
-  transform_data->origin = vec2(5, 5);
-  transform_data->position = ship_transform->position + vec3(heading * -15.0f, 0);
-  transform_data->position.z() = kLayerParticles;
-  
-  sprite_data->tint = vec4(1, 1, 0, 1);
-  sprite_data->texture = texture_path;
-
-  fade_data->counter = 500.0f;
-  fade_data->fade_point = 500.0f;
-  physics_data->velocity = kExhaustSpeed * heading;
+  // The ship has already moved this frame, so the emitter's cached world
+  // transform is a frame behind.
+  Affine2D emitter = GetSystem<TransformSystem>()->ComputeWorldTransform(
+      Data<PlayerShipData>(ship)->exhaust_emitter);
+  vec2 heading = -emitter.y_axis.Normalized();
+
+  GetSystem<ParticleSystem>()->pool(kExhaustParticles)->Spawn(
+      emitter.translation, kExhaustSpeed * heading, 10.0f, vec4(1, 1, 0, 1),
+      500.0f, 500.0f);
 }
 
 void PlayerShip::DeclareDependencies() {
@@ -115,15 +107,17 @@ void PlayerShip::DeclareDependencies() {
       corgi::kReadAccess, corgi::kAutoAdd);
   DependOn<TransformSystem>(corgi::kExecuteBefore,
       corgi::kReadWriteAccess, corgi::kAutoAdd);
+  DependOn<CollisionSystem>(corgi::kNoOrderDependency,
+      corgi::kReadWriteAccess, corgi::kAutoAdd);
 
-  DependOn<FadeTimerData>(corgi::kExecuteBefore,
+  DependOn<ParticleSystem>(corgi::kExecuteAfter,
       corgi::kReadWriteAccess, corgi::kNoAutoAdd);
   SetIsThreadSafe(true);
 }
 
 
 void PlayerShip::InitEntity(corgi::Entity entity) {
-  const char* texture_path = "rsc/ship.png";
+  static const TextureHandle ship_texture = InternTexture("rsc/ship.png");
 
   PlayerShipData* ship_data = Data<PlayerShipData>(entity);
 
@@ -132,8 +126,19 @@ void PlayerShip::InitEntity(corgi::Entity entity) {
   transform->position = vec3(kScreenWidth/2, kScreenHeight/2, kLayerPlayer);
   
   SpriteData* sprite = Data<SpriteData>(entity);
-  PhysicsData* physics = Data<PhysicsData>(entity);
+  auto physics = Data<PhysicsData>(entity);
 
   sprite->size = vec2(30, 30);
-  sprite->texture = texture_path;
+  sprite->texture = ship_texture;
+
+  ColliderData* collider = Data<ColliderData>(entity);
+  collider->radius = kShipRadius;
+  collider->layers = kCollisionShips;
+
+  // Ships point up, (towards -y) so behind is +y.
+  corgi::Entity emitter = entity_manager_->AllocateNewEntity();
+  entity_manager_->AddComponent<TransformSystem>(emitter);
+  Data<TransformData>(emitter)->position = vec3(0.0f, 15.0f, kLayerParticles);
+  GetSystem<TransformSystem>()->SetParent(emitter, entity);
+  ship_data->exhaust_emitter = emitter;
 }
\ No newline at end of file
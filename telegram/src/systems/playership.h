@@ -5,6 +5,8 @@
 
 struct PlayerShipData {
   int gun_cooldown;
+  // A child transform, trailing the ship, where exhaust comes out.
+  corgi::Entity exhaust_emitter;
 };
 
 
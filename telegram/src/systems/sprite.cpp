@@ -1,99 +1,350 @@
 #include "sprite.h"
 #include "transform.h"
 #include "common.h"
+#include "particles.h"
 #include "GL/glew.h"
 
+#include <assert.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
 
 
 CORGI_DEFINE_SYSTEM(SpriteSystem, SpriteData)
 
-void SpriteSystem::AddPointToBuffer(BufferInfo& buffer, vec4 p, vec2 uv, vec4 tint) {
-  int index = buffer.start_index + buffer.length;
-	vertex_buffer_[index++] = p.x();
-	vertex_buffer_[index++] = p.y();
-	vertex_buffer_[index++] = p.z();
-	vertex_buffer_[index++] = uv.x();	// u
-	vertex_buffer_[index++] = uv.y();	// v
-	vertex_buffer_[index++] = tint.x();	// r
-	vertex_buffer_[index++] = tint.y();	// g
-	vertex_buffer_[index++] = tint.z();	// b
-	vertex_buffer_[index++] = tint.w();	// a
-  buffer.length = index - buffer.start_index;
-  buffer.count++;
+void SpriteSystem::AddPointToBuffer(GLfloat*& out, vec2 p, float depth,
+    vec2 uv, vec4 tint) {
+	*out++ = p.x();
+	*out++ = p.y();
+	*out++ = depth;
+	*out++ = uv.x();	// u
+	*out++ = uv.y();	// v
+	*out++ = tint.x();	// r
+	*out++ = tint.y();	// g
+	*out++ = tint.z();	// b
+	*out++ = tint.w();	// a
 }
 
+// Tints are stored halved, as a fraction of 2.
+static GLubyte PackTint(float value) {
+  float scaled = value * 127.5f + 0.5f;
+  if (scaled <= 0.0f) return 0;
+  if (scaled >= 255.0f) return 255;
+  return static_cast<GLubyte>(scaled);
+}
+
+// UVs are normalized to 16 bits.
+static GLushort PackUV(float value) {
+  float scaled = value * 65535.0f + 0.5f;
+  if (scaled <= 0.0f) return 0;
+  if (scaled >= 65535.0f) return 0xffff;
+  return static_cast<GLushort>(scaled);
+}
+
+// Maps uv, (u0, v0, u1, v1) within an image, onto region, where the image
+// is in its texture.
+static vec4 MapUV(const vec4& region, const vec4& uv) {
+  float width = region.z() - region.x();
+  float height = region.w() - region.y();
+  return vec4(region.x() + uv.x() * width, region.y() + uv.y() * height,
+      region.x() + uv.z() * width, region.y() + uv.w() * height);
+}
+
+static void SetQuadVertex(SpriteVertex* vertex, vec2 p, float depth,
+    GLushort u, GLushort v, const GLubyte* tint) {
+  vertex->x = p.x();
+  vertex->y = p.y();
+  vertex->z = depth;
+  vertex->u = u;
+  vertex->v = v;
+  vertex->r = tint[0];
+  vertex->g = tint[1];
+  vertex->b = tint[2];
+  vertex->a = tint[3];
+}
+
+void SpriteSystem::AddQuadToBuffer(SpriteVertex* out, vec2 p1, vec2 p2,
+    vec2 p3, vec2 p4, float depth, const vec4& uv, vec4 tint) {
+  GLushort u0 = PackUV(uv.x()), v0 = PackUV(uv.y());
+  GLushort u1 = PackUV(uv.z()), v1 = PackUV(uv.w());
+  GLubyte packed[4] = {
+    PackTint(tint.x()), PackTint(tint.y()), PackTint(tint.z()),
+    PackTint(tint.w())
+  };
+  SetQuadVertex(out++, p1, depth, u0, v0, packed);
+  SetQuadVertex(out++, p2, depth, u1, v0, packed);
+  SetQuadVertex(out++, p3, depth, u0, v1, packed);
+  SetQuadVertex(out++, p4, depth, u1, v1, packed);
+}
+
+void SpriteSystem::AddInstanceToBuffer(SpriteInstance* out, vec2 corner,
+    vec2 x_axis, vec2 y_axis, float depth, const vec4& uv, vec4 tint) {
+  out->x = corner.x();
+  out->y = corner.y();
+  out->z = depth;
+  out->x_axis_x = x_axis.x();
+  out->x_axis_y = x_axis.y();
+  out->y_axis_x = y_axis.x();
+  out->y_axis_y = y_axis.y();
+  out->u0 = PackUV(uv.x());
+  out->v0 = PackUV(uv.y());
+  out->u1 = PackUV(uv.z());
+  out->v1 = PackUV(uv.w());
+  out->r = PackTint(tint.x());
+  out->g = PackTint(tint.y());
+  out->b = PackTint(tint.z());
+  out->a = PackTint(tint.w());
+}
+
+// Writes one sprite, in the current mode's layout, at an index in the
+// batch.  The sprite is the parallelogram with its (0, 0) corner at corner,
+// and its edges along x_axis and y_axis, showing uv of its texture.
+void SpriteSystem::AddSpriteToBuffer(int index, vec2 corner, vec2 x_axis,
+    vec2 y_axis, float depth, const vec4& uv, vec4 tint) {
+  assert(index < sprite_count_);
+  uint8_t* out = chunks_[index / kSpritesPerChunk].data() +
+      (index % kSpritesPerChunk) * bytes_per_sprite();
+
+  if (batch_mode_ == kSpriteInstanced) {
+    AddInstanceToBuffer(reinterpret_cast<SpriteInstance*>(out), corner,
+        x_axis, y_axis, depth, uv, tint);
+    return;
+  }
+
+  vec2 p1 = corner;
+  vec2 p2 = corner + x_axis;
+  vec2 p3 = corner + y_axis;
+  vec2 p4 = p2 + y_axis;
+
+  if (batch_mode_ == kSpriteIndexedQuads) {
+    AddQuadToBuffer(reinterpret_cast<SpriteVertex*>(out), p1, p2, p3, p4,
+        depth, uv, tint);
+    return;
+  }
+
+  // Two triangles.
+  GLfloat* points = reinterpret_cast<GLfloat*>(out);
+  vec2 uv1(uv.x(), uv.y());
+  vec2 uv2(uv.z(), uv.y());
+  vec2 uv3(uv.x(), uv.w());
+  vec2 uv4(uv.z(), uv.w());
+  AddPointToBuffer(points, p1, depth, uv1, tint);
+  AddPointToBuffer(points, p2, depth, uv2, tint);
+  AddPointToBuffer(points, p3, depth, uv3, tint);
+
+  AddPointToBuffer(points, p2, depth, uv2, tint);
+  AddPointToBuffer(points, p3, depth, uv3, tint);
+  AddPointToBuffer(points, p4, depth, uv4, tint);
+}
+
+size_t SpriteSystem::bytes_per_sprite() const {
+  switch (batch_mode_) {
+    case kSpriteTriangles:
+      return kFloatsPerSprite * sizeof(GLfloat);
+    case kSpriteIndexedQuads:
+      return kVerticesPerQuad * sizeof(SpriteVertex);
+    case kSpriteInstanced:
+      return sizeof(SpriteInstance);
+  }
+  assert(false);
+  return 0;
+}
+
+void SpriteSystem::set_batch_mode(SpriteBatchMode batch_mode) {
+  if (batch_mode == batch_mode_) return;
+  batch_mode_ = batch_mode;
+  // The chunks are sized for the old layout.  So is the batch built from
+  // them, which goes too, rather than being drawn from empty chunks.
+  chunks_.clear();
+  batches_.clear();
+  sprite_count_ = 0;
+}
+
+// Works out a texture's batch and UVs, the first time it comes up each
+// update.  Everything on the same atlas page shares a batch.
+void SpriteSystem::ResolveTexture(TextureHandle texture) {
+  TextureEntry& entry = textures_[texture];
+  entry.batch = -1;
+  entry.uv = vec4(0, 0, 1, 1);
+  const TextureRegion* region = texture_manager_ != nullptr ?
+      texture_manager_->FindRegion(texture) : nullptr;
+  GLuint page = 0;
+  if (region != nullptr) {
+    page = region->texture;
+    entry.uv = region->uv;
+    for (size_t i = 0; i < batches_.size(); i++) {
+      if (batches_[i].page == page) entry.batch = static_cast<int>(i);
+    }
+  }
+  if (entry.batch < 0) {
+    batches_.push_back(BufferInfo(texture, page));
+    entry.batch = static_cast<int>(batches_.size()) - 1;
+  }
+}
+
+// The batch is laid out, then filled, in slices of the sprites:
+//
+// 1. One quick pass looks up each sprite's batch by its texture handle,
+//    and counts how many of each batch are in each slice.  (A counting
+//    sort, in effect, with no strings involved.)
+// 2. A prefix sum over those counts, batch by batch and slice by slice
+//    within each, gives every slice its own range of each batch.
+// 3. Then the slices are filled in parallel, each writing only its own
+//    ranges.
+//
+// Particle pools are slices of their own, after the sprites.  Everything
+// lands in the same place it would if filled in order, so the result
+// doesn't depend on the thread count.
 void SpriteSystem::UpdateAllEntities(corgi::WorldTime delta_time) {
-  // First pass:  Just count how many sprites there are of each
-  // texture so we know how to map out vertex memory:
-  tex_count.clear();
-  for (auto itr = begin(); itr != end(); ++itr) {
-    if (tex_count.find(itr->data.texture) == tex_count.end()) {
-      tex_count[itr->data.texture] = 1;
-    } else {
-      tex_count[itr->data.texture]++;
+	query_.Update(entity_manager_);
+	SpriteData* const* sprites = query_.Column<SpriteData>();
+	TransformData* const* transforms = query_.Column<TransformData>();
+  int sprite_total = static_cast<int>(query_.size());
+  ParticleSystem* particle_system = GetSystem<ParticleSystem>();
+  int pool_count = static_cast<int>(particle_system->pool_count());
+
+  // (Copied out, since std::min takes references, and kMaxSlices has no
+  // definition to refer to.)
+  const int max_slices = kMaxSlices;
+  int sprite_slices = std::min(max_slices,
+      (sprite_total + kMinSliceSize - 1) / kMinSliceSize);
+  int slice_count = sprite_slices + pool_count;
+  slice_starts_.assign(sprite_slices + 1, 0);
+  for (int i = 1; i <= sprite_slices; i++) {
+    slice_starts_[i] = static_cast<int>(
+        static_cast<int64_t>(sprite_total) * i / sprite_slices);
+  }
+
+  // First pass:  which texture, and so batch, each sprite goes in, and how
+  // many of each batch there are in each slice.
+  texture_manager_ = headless_ ? nullptr :
+      GetSystem<CommonSystem>()->CommonData()->texture_manager;
+  batches_.clear();
+  TextureEntry unresolved = { -1, vec4(0, 0, 1, 1) };
+  textures_.assign(TextureHandleCount(), unresolved);
+  sprite_textures_.resize(sprite_total);
+  for (int i = 0; i < sprite_total; i++) {
+    TextureHandle texture = sprites[i]->texture;
+    assert(texture < textures_.size());
+    if (textures_[texture].batch < 0) ResolveTexture(texture);
+    sprite_textures_[i] = texture;
+  }
+  pool_textures_.resize(pool_count);
+  for (int i = 0; i < pool_count; i++) {
+    TextureHandle texture = particle_system->pool(i).texture();
+    if (textures_[texture].batch < 0) ResolveTexture(texture);
+    pool_textures_[i] = texture;
+  }
+
+  int batch_count = static_cast<int>(batches_.size());
+  slice_offsets_.assign(slice_count * batch_count, 0);
+  for (int slice = 0; slice < sprite_slices; slice++) {
+    int* counts = &slice_offsets_[slice * batch_count];
+    for (int i = slice_starts_[slice]; i < slice_starts_[slice + 1]; i++) {
+      counts[textures_[sprite_textures_[i]].batch]++;
     }
   }
+  for (int i = 0; i < pool_count; i++) {
+    int batch = textures_[pool_textures_[i]].batch;
+    slice_offsets_[(sprite_slices + i) * batch_count + batch] =
+        static_cast<int>(particle_system->pool(i).live_count());
+  }
 
   // Now figure out offsets into our buffer, for where each texture
-  // batch of sprites should live.
-  buffer.clear();
+  // batch of sprites should live, and each slice's part of it.
   int index = 0;
-  for (auto itr = tex_count.begin(); itr != tex_count.end(); ++itr) {
-    buffer[itr->first] = BufferInfo(index);
-    index += (1 + itr->second) * kFloatsPerPoint * kPointsPerSprite;
+  for (int batch = 0; batch < batch_count; batch++) {
+    batches_[batch].start_index = index;
+    for (int slice = 0; slice < slice_count; slice++) {
+      int& offset = slice_offsets_[slice * batch_count + batch];
+      int count = offset;
+      offset = index;
+      index += count;
+    }
+    batches_[batch].count = index - batches_[batch].start_index;
+  }
+  sprite_count_ = index;
+
+  // Grow to fit.  Chunks are never freed, so this only allocates when the
+  // sprite count reaches a new high.
+  size_t chunks_needed = (sprite_count_ + kSpritesPerChunk - 1) /
+      kSpritesPerChunk;
+  while (chunks_.size() < chunks_needed) {
+    chunks_.push_back(std::vector<uint8_t>(
+        kSpritesPerChunk * bytes_per_sprite()));
   }
 
-	for (auto itr = begin(); itr != end(); ++itr) {
-		corgi::Entity entity = itr->entity;
-		TransformData* transform_data = Data<TransformData>(entity);
-		SpriteData* sprite_data = Data<SpriteData>(entity);
-    BufferInfo b_info = buffer[sprite_data->texture];
-		
-		float width = sprite_data->size.x();
-		float height = sprite_data->size.y();
-		
-		vec4 origin_offset = vec4(transform_data->origin.x(),
-				transform_data->origin.y(), 0.0f, 0.0f);
-
-    float depth = transform_data->position.z();
-
-		vec4 p1 = vec4(0.0f,  0.0f,   depth, 1.0f) - origin_offset;
-		vec4 p2 = vec4(width, 0.0f,   depth, 1.0f) - origin_offset;
-		vec4 p3 = vec4(0.0f,  height, depth, 1.0f) - origin_offset;
-		vec4 p4 = vec4(width, height, depth, 1.0f) - origin_offset;
-
-		mat4 transform_matrix = transform_data->GetTransformMatrix();
-		p1 = transform_matrix * p1;
-		p2 = transform_matrix * p2;
-		p3 = transform_matrix * p3;
-		p4 = transform_matrix * p4;
-
-		AddPointToBuffer(b_info, p1, vec2(0, 0), sprite_data->tint);
-		AddPointToBuffer(b_info, p2, vec2(1, 0), sprite_data->tint);
-		AddPointToBuffer(b_info, p3, vec2(0, 1), sprite_data->tint);
-
-		AddPointToBuffer(b_info, p2, vec2(1, 0), sprite_data->tint);
-		AddPointToBuffer(b_info, p3, vec2(0, 1), sprite_data->tint);
-		AddPointToBuffer(b_info, p4, vec2(1, 1), sprite_data->tint);
-
-    // shove it back into the map now that we've updated it.
-    buffer[sprite_data->texture] = b_info;
-	}
+  ParallelFor(slice_count, [&](size_t begin, size_t end) {
+    for (size_t slice = begin; slice < end; slice++) {
+      int* offsets = &slice_offsets_[slice * batch_count];
+      if (slice >= static_cast<size_t>(sprite_slices)) {
+        size_t pool = slice - sprite_slices;
+        const TextureEntry& entry = textures_[pool_textures_[pool]];
+        AddParticlesToBuffer(particle_system->pool(pool),
+            offsets[entry.batch], entry.uv);
+        continue;
+      }
+      for (int i = slice_starts_[slice]; i < slice_starts_[slice + 1]; i++) {
+        TransformData* transform_data = transforms[i];
+        SpriteData* sprite_data = sprites[i];
+
+        // The world transform is cached by TransformSystem, (which runs
+        // first) so this is just one corner through a 2x3 matrix, and its
+        // axes scaled to the sprite's size.
+        const Affine2D& world = transform_data->world_transform;
+        vec2 corner = world.Apply(-transform_data->origin);
+        vec2 x_axis = world.x_axis * sprite_data->size.x();
+        vec2 y_axis = world.y_axis * sprite_data->size.y();
+
+        const TextureEntry& entry = textures_[sprite_textures_[i]];
+        AddSpriteToBuffer(offsets[entry.batch]++, corner, x_axis, y_axis,
+            transform_data->position.z(), MapUV(entry.uv, sprite_data->uv),
+            sprite_data->tint);
+      }
+    }
+  });
 }
 
+// Particles go straight from their pool into the batch for their texture,
+// as unrotated squares, starting at index.
+void SpriteSystem::AddParticlesToBuffer(const ParticlePool& pool, int index,
+    const vec4& uv) {
+  float depth = pool.depth();
+  for (size_t slot = 0; slot < pool.slot_count(); slot++) {
+    if (!pool.IsLive(slot)) continue;
+
+    float half_size = pool.half_size(slot);
+    float size = half_size * 2.0f;
+    vec2 corner = pool.position(slot) - vec2(half_size, half_size);
+
+    AddSpriteToBuffer(index++, corner, vec2(size, 0.0f), vec2(0.0f, size),
+        depth, uv, pool.tint(slot));
+  }
+}
+
+// For kSpriteInstanced, each vertex is one corner of a quad, 0 or 1 along
+// each axis, and the rest is per instance:  a_vertex is the (0, 0) corner,
+// a_x_axis and a_y_axis are its edges, and a_tex_uv is the UV rectangle,
+// (u0, v0, u1, v1).  The other modes leave the corner and axis attributes
+// disabled, so they read as zero, and a_tex_uv's zw as (0, 1).  Then
+// this is just the plain vertex again.
 const char vShaderStr[] =
 "attribute vec4 a_vertex;          \n"
 "uniform mat4 u_mvp;               \n"
-"attribute vec2 a_tex_uv;          \n"
+"uniform float u_tint_scale;       \n"
+"attribute vec4 a_tex_uv;          \n"
 "attribute vec4 a_tint;            \n"
+"attribute vec2 a_corner;          \n"
+"attribute vec2 a_x_axis;          \n"
+"attribute vec2 a_y_axis;          \n"
 "varying vec4 v_tint;              \n"
 "varying vec2 v_tex_uv;            \n"
 "void main() {                     \n"
-"  v_tint = a_tint;                \n"
-"  v_tex_uv = a_tex_uv;            \n"
-"  gl_Position = u_mvp * a_vertex;   \n"
+"  v_tint = a_tint * u_tint_scale; \n"
+"  v_tex_uv = mix(a_tex_uv.xy, a_tex_uv.zw, a_corner); \n"
+"  vec2 offset = a_x_axis * a_corner.x + a_y_axis * a_corner.y; \n"
+"  gl_Position = u_mvp * (a_vertex + vec4(offset, 0.0, 0.0)); \n"
 "}                                 \n";
 
 const char fShaderStr[] =
@@ -112,8 +363,13 @@ void SpriteSystem::DeclareDependencies() {
 
 	DependOn<CommonSystem>(corgi::kNoOrderDependency,
       corgi::kReadAccess, corgi::kNoAutoAdd);
+  DependOn<ParticleSystem>(corgi::kExecuteAfter,
+      corgi::kReadAccess, corgi::kNoAutoAdd);
 
 	SetIsThreadSafe(true);
+	// The batch is filled a slice at a time (see UpdateAllEntities), and
+	// each slice is already plenty for one job.
+	SetParallelChunkSize(1);
 }
 
 void SpriteSystem::Cleanup() {
@@ -121,6 +377,18 @@ void SpriteSystem::Cleanup() {
 	SDL_FreeSurface(hello_world);
 	hello_world = NULL;
 
+	if (!headless_) {
+		DeleteChunkBuffers();
+		if (index_buffer_object_ != 0) {
+			glDeleteBuffers(1, &index_buffer_object_);
+			index_buffer_object_ = 0;
+		}
+		if (corner_buffer_object_ != 0) {
+			glDeleteBuffers(1, &corner_buffer_object_);
+			corner_buffer_object_ = 0;
+		}
+	}
+
 }
 
 void SpriteSystem::InitEntity(corgi::Entity entity) {
@@ -128,8 +396,8 @@ void SpriteSystem::InitEntity(corgi::Entity entity) {
 }
 
 void SpriteSystem::RenderSprites() {
+	if (headless_) return;
 	CommonComponent* common = entity_manager_->GetSystem<CommonSystem>()->CommonData();
-	mat4 vp_matrix = mat4::Ortho(0.0f, 640.0f, 480.0f, 0.0f, -1.0f, 1.0f, 1.0f);
 
 	// Set the viewport
 	glViewport(0, 0, static_cast<GLsizei>(common->screen_size.x()),
@@ -140,30 +408,154 @@ void SpriteSystem::RenderSprites() {
 
 	// Use the program object
 	glUseProgram(shader_program);
+	if (tint_scale_loc_ != -1) {
+		glUniform1f(tint_scale_loc_,
+				batch_mode_ == kSpriteTriangles ? 1.0f : 2.0f);
+	}
 
-	GLint loc = glGetUniformLocation(shader_program, "u_mvp");
-	if (loc != -1) {
-		glUniformMatrix4fv(loc, 1, false, &vp_matrix[0]);
+	// The attribute layout is baked into the vertex arrays, so they all
+	// need remaking if the mode changed.
+	if (buffers_mode_ != batch_mode_) {
+		DeleteChunkBuffers();
+		buffers_mode_ = batch_mode_;
 	}
 
-	int stride = sizeof(GLfloat) * kFloatsPerPoint;
+	// Orphan last frame's storage first, so the driver can hand us fresh
+	// memory rather than waiting for the GPU to finish drawing from it.
+	// Then only the part of each chunk that's in use gets uploaded.
+	size_t chunks_used = (sprite_count_ + kSpritesPerChunk - 1) /
+			kSpritesPerChunk;
+	while (vertex_buffer_objects_.size() < chunks_used) {
+		AddChunkBuffers();
+	}
+	for (size_t i = 0; i < chunks_used; i++) {
+		int sprites = sprite_count_ - static_cast<int>(i) * kSpritesPerChunk;
+		if (sprites > kSpritesPerChunk) sprites = kSpritesPerChunk;
+		glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_objects_[i]);
+		glBufferData(GL_ARRAY_BUFFER, chunks_[i].size(), nullptr,
+				GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sprites * bytes_per_sprite(),
+				chunks_[i].data());
+	}
 
-	glVertexAttribPointer(kVertexLoc, 3, GL_FLOAT, GL_FALSE, stride, vertex_buffer_ + 0);
-	glVertexAttribPointer(kTextureUVLoc, 2, GL_FLOAT, GL_FALSE, stride, vertex_buffer_ + 3);
-	glVertexAttribPointer(kTintLoc, 4, GL_FLOAT, GL_FALSE, stride, vertex_buffer_ + 5);
+  for (size_t i = 0; i < batches_.size(); i++) {
+    const BufferInfo& b_info = batches_[i];
+
+    GLuint texture = b_info.page != 0 ? b_info.page :
+        common->texture_manager->GetTexture(b_info.texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    // One draw for each chunk the batch falls in.
+    int first = b_info.start_index;
+    int end = b_info.start_index + b_info.count;
+    while (first < end) {
+      int chunk = first / kSpritesPerChunk;
+      int last = std::min(end, (chunk + 1) * kSpritesPerChunk);
+      int chunk_first = first - chunk * kSpritesPerChunk;
+      glBindVertexArray(vertex_arrays_[chunk]);
+      if (batch_mode_ == kSpriteInstanced) {
+        // There's no base instance before GL 4.2, so point the instance
+        // attributes at the first one instead.
+        glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_objects_[chunk]);
+        SetInstanceAttributes(chunk_first);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, kVerticesPerQuad,
+            last - first);
+      } else if (batch_mode_ == kSpriteIndexedQuads) {
+        glDrawElements(GL_TRIANGLES, (last - first) * kIndicesPerQuad,
+            GL_UNSIGNED_SHORT, reinterpret_cast<const GLvoid*>(
+            chunk_first * kIndicesPerQuad * sizeof(GLushort)));
+      } else {
+        glDrawArrays(GL_TRIANGLES, chunk_first * kPointsPerSprite,
+            (last - first) * kPointsPerSprite);
+      }
+      first = last;
+    }
+  }
+	glBindVertexArray(0);
+}
+
+// Makes the buffer object for one more chunk, and a vertex array object
+// that reads it.  The buffer's contents are replaced each frame, but the
+// attribute pointers into it stay put.
+void SpriteSystem::AddChunkBuffers() {
+	GLuint vertex_array;
+	GLuint vertex_buffer_object;
+	glGenVertexArrays(1, &vertex_array);
+	glGenBuffers(1, &vertex_buffer_object);
+	glBindVertexArray(vertex_array);
+	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_object);
+	glBufferData(GL_ARRAY_BUFFER, kSpritesPerChunk * bytes_per_sprite(),
+			nullptr, GL_STREAM_DRAW);
+
+	if (batch_mode_ == kSpriteInstanced) {
+		SetInstanceAttributes(0);
+		glEnableVertexAttribArray(kCornerLoc);
+		glEnableVertexAttribArray(kXAxisLoc);
+		glEnableVertexAttribArray(kYAxisLoc);
+		glBindBuffer(GL_ARRAY_BUFFER, corner_buffer_object_);
+		glVertexAttribPointer(kCornerLoc, 2, GL_UNSIGNED_BYTE, GL_FALSE, 0,
+				reinterpret_cast<const GLvoid*>(0));
+	} else if (batch_mode_ == kSpriteIndexedQuads) {
+		int stride = sizeof(SpriteVertex);
+		glVertexAttribPointer(kVertexLoc, 3, GL_FLOAT, GL_FALSE, stride,
+				reinterpret_cast<const GLvoid*>(offsetof(SpriteVertex, x)));
+		glVertexAttribPointer(kTextureUVLoc, 2, GL_UNSIGNED_SHORT, GL_TRUE,
+				stride, reinterpret_cast<const GLvoid*>(offsetof(SpriteVertex, u)));
+		glVertexAttribPointer(kTintLoc, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+				reinterpret_cast<const GLvoid*>(offsetof(SpriteVertex, r)));
+		// Part of the vertex array's state, so it's bound once, here.
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_object_);
+	} else {
+		int stride = sizeof(GLfloat) * kFloatsPerPoint;
+		glVertexAttribPointer(kVertexLoc, 3, GL_FLOAT, GL_FALSE, stride,
+				reinterpret_cast<const GLvoid*>(0));
+		glVertexAttribPointer(kTextureUVLoc, 2, GL_FLOAT, GL_FALSE, stride,
+				reinterpret_cast<const GLvoid*>(sizeof(GLfloat) * 3));
+		glVertexAttribPointer(kTintLoc, 4, GL_FLOAT, GL_FALSE, stride,
+				reinterpret_cast<const GLvoid*>(sizeof(GLfloat) * 5));
+	}
 
 	glEnableVertexAttribArray(kVertexLoc);
 	glEnableVertexAttribArray(kTextureUVLoc);
 	glEnableVertexAttribArray(kTintLoc);
+	glBindVertexArray(0);
 
-  for (auto itr = buffer.begin(); itr != buffer.end(); ++itr) {
-    const char* texture_name = itr->first;
-    BufferInfo b_info = itr->second;
+	vertex_arrays_.push_back(vertex_array);
+	vertex_buffer_objects_.push_back(vertex_buffer_object);
+}
 
-    GLuint texture = common->texture_manager->GetTexture(texture_name);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glDrawArrays(GL_TRIANGLES, b_info.start_index / kFloatsPerPoint, b_info.count);
-  }
+// Points the per-instance attributes at instance first of the bound
+// buffer.
+void SpriteSystem::SetInstanceAttributes(int first) {
+	int stride = sizeof(SpriteInstance);
+	size_t base = first * sizeof(SpriteInstance);
+	glVertexAttribPointer(kVertexLoc, 3, GL_FLOAT, GL_FALSE, stride,
+			reinterpret_cast<const GLvoid*>(base + offsetof(SpriteInstance, x)));
+	glVertexAttribPointer(kXAxisLoc, 2, GL_FLOAT, GL_FALSE, stride,
+			reinterpret_cast<const GLvoid*>(
+			base + offsetof(SpriteInstance, x_axis_x)));
+	glVertexAttribPointer(kYAxisLoc, 2, GL_FLOAT, GL_FALSE, stride,
+			reinterpret_cast<const GLvoid*>(
+			base + offsetof(SpriteInstance, y_axis_x)));
+	glVertexAttribPointer(kTextureUVLoc, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+			reinterpret_cast<const GLvoid*>(base + offsetof(SpriteInstance, u0)));
+	glVertexAttribPointer(kTintLoc, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+			reinterpret_cast<const GLvoid*>(base + offsetof(SpriteInstance, r)));
+	glVertexAttribDivisor(kVertexLoc, 1);
+	glVertexAttribDivisor(kXAxisLoc, 1);
+	glVertexAttribDivisor(kYAxisLoc, 1);
+	glVertexAttribDivisor(kTextureUVLoc, 1);
+	glVertexAttribDivisor(kTintLoc, 1);
+}
+
+void SpriteSystem::DeleteChunkBuffers() {
+	if (vertex_arrays_.empty()) return;
+	glDeleteBuffers(static_cast<GLsizei>(vertex_buffer_objects_.size()),
+			vertex_buffer_objects_.data());
+	glDeleteVertexArrays(static_cast<GLsizei>(vertex_arrays_.size()),
+			vertex_arrays_.data());
+	vertex_buffer_objects_.clear();
+	vertex_arrays_.clear();
 }
 
 
@@ -209,6 +601,8 @@ GLuint LoadShader(const char *shaderSrc, GLenum type) {
 
 
 void SpriteSystem::Init() {
+	if (headless_) return;
+
 	GLuint vertexShader;
 	GLuint fragmentShader;
 	GLuint programObject;
@@ -232,6 +626,9 @@ void SpriteSystem::Init() {
 	glBindAttribLocation(programObject, kVertexLoc, "a_vertex");
 	glBindAttribLocation(programObject, kTextureUVLoc, "a_tex_uv");
 	glBindAttribLocation(programObject, kTintLoc, "a_tint");
+	glBindAttribLocation(programObject, kCornerLoc, "a_corner");
+	glBindAttribLocation(programObject, kXAxisLoc, "a_x_axis");
+	glBindAttribLocation(programObject, kYAxisLoc, "a_y_axis");
 
 	// Link the program
 	glLinkProgram(programObject);
@@ -250,4 +647,44 @@ void SpriteSystem::Init() {
 	}
 
 	shader_program = programObject;
+
+	// The projection never changes, so it's set once, here.
+	mat4 vp_matrix = mat4::Ortho(0.0f, 640.0f, 480.0f, 0.0f, -1.0f, 1.0f, 1.0f);
+	glUseProgram(shader_program);
+	GLint loc = glGetUniformLocation(shader_program, "u_mvp");
+	if (loc != -1) {
+		glUniformMatrix4fv(loc, 1, false, &vp_matrix[0]);
+	}
+	tint_scale_loc_ = glGetUniformLocation(shader_program, "u_tint_scale");
+
+	// Quad i of a chunk is vertices 4i to 4i + 3, as two triangles the same
+	// way round as kSpriteTriangles draws them.  That's the same for every
+	// chunk, so one index buffer covers them all.
+	static_assert(kSpritesPerChunk * kVerticesPerQuad <= 0x10000,
+			"Chunks must fit 16-bit indices");
+	std::vector<GLushort> indices(kSpritesPerChunk * kIndicesPerQuad);
+	for (int i = 0; i < kSpritesPerChunk; i++) {
+		GLushort first = static_cast<GLushort>(i * kVerticesPerQuad);
+		GLushort* quad = &indices[i * kIndicesPerQuad];
+		quad[0] = first;
+		quad[1] = first + 1;
+		quad[2] = first + 2;
+		quad[3] = first + 1;
+		quad[4] = first + 2;
+		quad[5] = first + 3;
+	}
+	glGenBuffers(1, &index_buffer_object_);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_object_);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort),
+			indices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	// And kSpriteInstanced's quad, as a triangle strip in the same order.
+	static const GLubyte kCorners[kVerticesPerQuad * 2] = {
+		0, 0,  1, 0,  0, 1,  1, 1
+	};
+	glGenBuffers(1, &corner_buffer_object_);
+	glBindBuffer(GL_ARRAY_BUFFER, corner_buffer_object_);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(kCorners), kCorners, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
\ No newline at end of file
@@ -2,37 +2,87 @@
 #define SPRITE_SYSTEM_H
 #include <SDL.h>
 #include <SDL_image.h>
+#include <stdint.h>
+#include <vector>
+#include "corgi/query.h"
 #include "corgi/system.h"
 #include "math_common.h"
+#include "texture_handle.h"
+#include "transform.h"
 #include "GL/glew.h"
 
+class ParticlePool;
+class TextureManager;
+
 struct SpriteData {
 	//int texture; // make this something real!
-  SpriteData() : uv(0, 0), size(1, 1), tint(1, 1, 1, 1) {}
-	vec2 uv;
+  SpriteData() : uv(0, 0, 1, 1), size(1, 1), tint(1, 1, 1, 1) {}
+	// The part of the texture to draw, as (u0, v0, u1, v1).  If the texture
+	// is in the atlas, this is mapped onto its place in the page.
+	vec4 uv;
 	vec2 size;
 	vec4 tint;
-  const char* texture = nullptr;
+  // From InternTexture.
+  TextureHandle texture = kNoTexture;
 };
 
-// Info about a vertex buffer.
+// Where one texture's sprites go in the batch.  Counted in sprites, not
+// floats.  An atlas page is one texture, however many images are on it.
 struct BufferInfo {
   BufferInfo() :
+    texture(kNoTexture),
+    page(0),
     start_index(0),
-    length(0),
     count(0) {
   }
 
-  BufferInfo(int startIndex) :
-    start_index(startIndex),
-    length(0),
+  BufferInfo(TextureHandle texture, GLuint page) :
+    texture(texture),
+    page(page),
+    start_index(0),
     count(0) {}
 
+  // If page is 0, this isn't in the atlas, and gets texture on its own.
+  TextureHandle texture;
+  GLuint page;
   int start_index;
-  int length;
   int count;
 };
 
+// How SpriteSystem lays out and draws its batch.
+enum SpriteBatchMode {
+  // Two triangles per sprite, as 6 vertices of 9 floats:  216 bytes.
+  kSpriteTriangles,
+  // A quad per sprite, as 4 compact vertices (float position, 16-bit UV,
+  // 8-bit tint) drawn through a shared, static index buffer:  80 bytes.
+  kSpriteIndexedQuads,
+  // One SpriteInstance per sprite, expanded into a quad by the vertex
+  // shader:  40 bytes, and no corners to work out on the CPU.  Needs
+  // instancing (GL 3.3, or ARB_instanced_arrays).
+  kSpriteInstanced,
+};
+
+// One vertex of an indexed quad.  The UV is normalized to [0, 1], and the
+// tint is stored halved, normalized to [0, 2], so the overbright tints
+// some sprites use still come through.
+struct SpriteVertex {
+  GLfloat x, y, z;
+  GLushort u, v;
+  GLubyte r, g, b, a;
+};
+
+// One sprite, for kSpriteInstanced.  Its quad is the parallelogram from
+// (x, y) along the two axes, so they carry its rotation, scale and size,
+// and the origin is already taken off (x, y).  The UV rectangle (u0, v0)
+// to (u1, v1) and the tint are normalized like SpriteVertex's.
+struct SpriteInstance {
+  GLfloat x, y, z;
+  GLfloat x_axis_x, x_axis_y;
+  GLfloat y_axis_x, y_axis_y;
+  GLushort u0, v0, u1, v1;
+  GLubyte r, g, b, a;
+};
+
 class SpriteSystem : public corgi::System<SpriteData> {
 public:
 
@@ -43,34 +93,121 @@ public:
 	virtual void InitEntity(corgi::Entity entity);
 	void RenderSprites();
 
-private:
-	void AddPointToBuffer(BufferInfo& buffer, vec4 p, vec2 uv, vec4 tint);
+	// Headless sprite systems still build their vertex buffers every
+	// update, but never touch GL.  (Used by the benchmark driver, which
+	// has no window or GL context.)  Must be set before Init.
+	void set_headless(bool headless) { headless_ = headless; }
+	bool headless() const { return headless_; }
 
-	static const int kMaxSprites = 1500;
+	// Defaults to kSpriteIndexedQuads.  Takes effect at the next update.
+	// Until then, there's nothing to draw.
+	void set_batch_mode(SpriteBatchMode batch_mode);
+	SpriteBatchMode batch_mode() const { return batch_mode_; }
+
+	// How many sprites (and particles) went into the batch at the last
+	// update, and how many chunks that took.
+	int sprite_count() const { return sprite_count_; }
+	size_t chunk_count() const { return chunks_.size(); }
+
+	// The size of one sprite in the current mode's layout, and so how
+	// much is uploaded each frame.  (The index buffer is uploaded once.)
+	size_t bytes_per_sprite() const;
+	size_t vertex_bytes() const { return sprite_count_ * bytes_per_sprite(); }
+
+private:
+	void AddPointToBuffer(GLfloat*& out, vec2 p, float depth, vec2 uv,
+			vec4 tint);
+	void AddQuadToBuffer(SpriteVertex* out, vec2 p1, vec2 p2, vec2 p3,
+			vec2 p4, float depth, const vec4& uv, vec4 tint);
+	void AddInstanceToBuffer(SpriteInstance* out, vec2 corner, vec2 x_axis,
+			vec2 y_axis, float depth, const vec4& uv, vec4 tint);
+	void AddSpriteToBuffer(int index, vec2 corner, vec2 x_axis, vec2 y_axis,
+			float depth, const vec4& uv, vec4 tint);
+	void AddParticlesToBuffer(const ParticlePool& pool, int index,
+			const vec4& uv);
+	void ResolveTexture(TextureHandle texture);
+	void AddChunkBuffers();
+	void DeleteChunkBuffers();
+	void SetInstanceAttributes(int first);
+
+	// For kSpriteTriangles:
 	static const int kPointsPerSprite = 6;
 
 	// 4 points, each point contains 3 axis coordinates, 2 UV coordinates, and 4 tint values.
 	//static const int kSpriteSize = (sizeof(float) * (3 + 2 + 4) * 4);
 	static const int kFloatsPerPoint = 3 + 2 + 4;
+	static const int kFloatsPerSprite = kPointsPerSprite * kFloatsPerPoint;
 
-	static const int kTotalBufferSize = kMaxSprites * kPointsPerSprite * kFloatsPerPoint;
+	// For kSpriteIndexedQuads:
+	static const int kVerticesPerQuad = 4;
+	static const int kIndicesPerQuad = 6;
+
+	// The batch is split into chunks of this many sprites, each with its own
+	// buffer object, and a texture's sprites are drawn with one call per
+	// chunk they fall in.  Chunks are added as needed, and kept.  (This is
+	// as many quads as 16-bit indices can reach.)
+	static const int kSpritesPerChunk = 16384;
+
+	// The sprites are split into at most kMaxSlices slices, of at least
+	// kMinSliceSize each, to be filled in parallel.
+	static const int kMaxSlices = 64;
+	static const int kMinSliceSize = 1024;
 
 	static const int kVertexLoc = 0;
 	static const int kTextureUVLoc = 1;
 	static const int kTintLoc = 2;
+	static const int kCornerLoc = 3;
+	static const int kXAxisLoc = 4;
+	static const int kYAxisLoc = 5;
 
 
 	SDL_Surface* hello_world = NULL;
 
-	GLuint shader_program;
+	bool headless_ = false;
+	SpriteBatchMode batch_mode_ = kSpriteIndexedQuads;
 
-	GLfloat vertex_buffer_[kTotalBufferSize];
-	
-	//int buffer_length_;
-	//int buffer_count_;
+	GLuint shader_program;
 
-  std::map<const char*, int> tex_count;
-  std::map<const char*, BufferInfo> buffer;
+	// Each chunk's vertices are streamed into its own buffer object every
+	// frame, through a vertex array object that's set up when the chunk is
+	// first drawn.
+	std::vector<GLuint> vertex_arrays_;
+	std::vector<GLuint> vertex_buffer_objects_;
+	// The mode the chunk buffers above were set up for.
+	SpriteBatchMode buffers_mode_ = kSpriteIndexedQuads;
+	// Every chunk's quads are numbered from 0, so they all share this.
+	GLuint index_buffer_object_ = 0;
+	// The four corners of kSpriteInstanced's quad.
+	GLuint corner_buffer_object_ = 0;
+	GLint tint_scale_loc_ = -1;
+
+	// In whichever vertex layout the mode uses.
+	std::vector<std::vector<uint8_t>> chunks_;
+	int sprite_count_ = 0;
+
+  // One per atlas page, or texture outside the atlas, in the order they
+  // were first seen this update, which is the order they're drawn in.
+  std::vector<BufferInfo> batches_;
+
+  // Indexed by handle:  the batch each texture goes in this update, (or -1
+  // if it hasn't come up yet) and where it is in its page.
+  struct TextureEntry {
+    int batch;
+    vec4 uv;
+  };
+  std::vector<TextureEntry> textures_;
+  // Where ResolveTexture looks for the atlas.  (Null when headless.)
+  const TextureManager* texture_manager_ = nullptr;
+
+  // Scratch for UpdateAllEntities:  each sprite's texture, and each pool's;
+  // where each slice starts; and each slice's next index in each batch
+  // (slice-major).
+  std::vector<TextureHandle> sprite_textures_;
+  std::vector<TextureHandle> pool_textures_;
+  std::vector<int> slice_starts_;
+  std::vector<int> slice_offsets_;
+
+  corgi::Query<SpriteData, TransformData> query_;
 };
 
 
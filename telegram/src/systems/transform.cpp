@@ -1,4 +1,5 @@
 #include <SDL.h>
+#include <assert.h>
 #include "transform.h"
 
 CORGI_DEFINE_SYSTEM(TransformSystem, TransformData)
@@ -10,12 +11,162 @@ void TransformSystem::DeclareDependencies() {
 
 void TransformSystem::Init() {
 	SetIsThreadSafe(true);
+	SetParallelChunkSize(1024);
 }
 
 
+// Brings the cached world transforms up to date.  Roots first, in one pass,
+// recomputing only the ones something touched since last time.  Then the
+// children, a level at a time, so every parent is done before its children.
+// (They're recomputed every time, since their parents may have moved.)
 void TransformSystem::UpdateAllEntities(corgi::WorldTime delta_time) {
-//	printf("TransformSystem - starting update!\n");
+	ParallelForEachEntity([](corgi::Entity, TransformData* transform) {
+		if (transform->dirty && transform->parent == corgi::kInvalidEntityId) {
+			transform->world_transform = transform->LocalTransform();
+			transform->dirty = false;
+		}
+	});
+
+	for (size_t i = 0; i < levels_.size(); i++) {
+		const std::vector<HierarchyLink>& level = levels_[i];
+		ParallelFor(level.size(), [this, &level](size_t begin, size_t end) {
+			for (size_t j = begin; j < end; j++) {
+				TransformData* child = GetComponentData(level[j].entity);
+				const TransformData* parent = GetComponentData(level[j].parent);
+				child->world_transform =
+						parent->world_transform * child->LocalTransform();
+				child->dirty = false;
+			}
+		});
+	}
+}
+
+
+void TransformSystem::CleanupEntity(corgi::Entity entity) {
+	HierarchyNode* node = FindNode(entity);
+	if (!node) return;
+
+	// Children go with their parent.
+	corgi::Entity child = node->first_child;
+	while (child != corgi::kInvalidEntityId) {
+		corgi::Entity next = FindNode(child)->next_sibling;
+		SetParent(child, corgi::kInvalidEntityId);
+		entity_manager_->DeleteEntity(child);
+		child = next;
+	}
+	SetParent(entity, corgi::kInvalidEntityId);
+	FindNode(entity)->entity = corgi::kInvalidEntityId;
+}
+
+
+void TransformSystem::SetParent(corgi::Entity child, corgi::Entity parent) {
+	assert(HasDataForEntity(child));
+	assert(parent == corgi::kInvalidEntityId || HasDataForEntity(parent));
+	// No cycles.
+	for (corgi::Entity ancestor = parent; ancestor != corgi::kInvalidEntityId;
+			ancestor = GetComponentData(ancestor)->parent) {
+		assert(ancestor != child);
+	}
+
+	// Both nodes first, since adding one can move the other.
+	AddNode(child);
+	if (parent != corgi::kInvalidEntityId) AddNode(parent);
+	HierarchyNode* node = FindNode(child);
+	Unlink(node);
+
+	int depth = 0;
+	if (parent != corgi::kInvalidEntityId) {
+		HierarchyNode* parent_node = FindNode(parent);
+		node->next_sibling = parent_node->first_child;
+		if (node->next_sibling != corgi::kInvalidEntityId) {
+			FindNode(node->next_sibling)->prev_sibling = child;
+		}
+		parent_node->first_child = child;
+		depth = parent_node->depth + 1;
+	}
+	node->parent = parent;
+
+	TransformData* transform = GetComponentData(child);
+	transform->parent = parent;
+	transform->dirty = true;
+	SetDepth(child, depth);
+}
+
+
+Affine2D TransformSystem::ComputeWorldTransform(corgi::Entity entity) {
+	TransformData* transform = GetComponentData(entity);
+	Affine2D world = transform->LocalTransform();
+	while (transform->parent != corgi::kInvalidEntityId) {
+		transform = GetComponentData(transform->parent);
+		world = transform->LocalTransform() * world;
+	}
+	return world;
+}
+
+
+TransformSystem::HierarchyNode* TransformSystem::FindNode(
+		corgi::Entity entity) {
+	size_t index = corgi::EntityIndex(entity);
+	if (index >= nodes_.size() || nodes_[index].entity != entity) {
+		return nullptr;
+	}
+	return &nodes_[index];
+}
+
+
+TransformSystem::HierarchyNode* TransformSystem::AddNode(
+		corgi::Entity entity) {
+	size_t index = corgi::EntityIndex(entity);
+	if (index >= nodes_.size()) nodes_.resize(index + 1);
+	HierarchyNode& node = nodes_[index];
+	if (node.entity != entity) {
+		node = HierarchyNode();
+		node.entity = entity;
+	}
+	return &node;
+}
+
+
+// Takes a node out of its parent's list of children.
+void TransformSystem::Unlink(HierarchyNode* node) {
+	if (node->parent == corgi::kInvalidEntityId) return;
+	if (node->prev_sibling != corgi::kInvalidEntityId) {
+		FindNode(node->prev_sibling)->next_sibling = node->next_sibling;
+	} else {
+		FindNode(node->parent)->first_child = node->next_sibling;
+	}
+	if (node->next_sibling != corgi::kInvalidEntityId) {
+		FindNode(node->next_sibling)->prev_sibling = node->prev_sibling;
+	}
+	node->parent = corgi::kInvalidEntityId;
+	node->next_sibling = corgi::kInvalidEntityId;
+	node->prev_sibling = corgi::kInvalidEntityId;
+}
 
-	//printf("TransformSystem - ending update!\n");
 
+// Moves an entity, and everything under it, to the right levels for its
+// new depth.  (Its parent link has to be set already.)
+void TransformSystem::SetDepth(corgi::Entity entity, int depth) {
+	HierarchyNode* node = FindNode(entity);
+	if (node->depth > 0) {
+		// Swapped out of its old level.
+		std::vector<HierarchyLink>& level = levels_[node->depth - 1];
+		HierarchyLink& moved = level.back();
+		FindNode(moved.entity)->level_index = node->level_index;
+		level[node->level_index] = moved;
+		level.pop_back();
+		while (!levels_.empty() && levels_.back().empty()) levels_.pop_back();
+	}
+	node->depth = depth;
+	if (depth > 0) {
+		if (levels_.size() < static_cast<size_t>(depth)) levels_.resize(depth);
+		HierarchyLink link = {entity, node->parent};
+		node->level_index = levels_[depth - 1].size();
+		levels_[depth - 1].push_back(link);
+	}
+	for (corgi::Entity child = node->first_child;
+			child != corgi::kInvalidEntityId;
+			child = FindNode(child)->next_sibling) {
+		SetDepth(child, depth + 1);
+	}
 }
@@ -1,43 +1,76 @@
 #ifndef TRANSFORM_H
 #define TRANSFORM_H
+#include <vector>
 #include "corgi/system.h"
 #include "math_common.h"
 
+// A 2D affine transform, stored as a 2x3 matrix:  where the local x and y
+// axes end up, and where the local origin does.
+struct Affine2D {
+	Affine2D() : x_axis(1, 0), y_axis(0, 1), translation(0, 0) {}
+
+	vec2 Apply(const vec2& point) const {
+		return x_axis * point.x() + y_axis * point.y() + translation;
+	}
+
+	// Like Apply, but for directions, which aren't translated.
+	vec2 ApplyToDirection(const vec2& direction) const {
+		return x_axis * direction.x() + y_axis * direction.y();
+	}
+
+	// The transform that applies other, then this.
+	Affine2D operator*(const Affine2D& other) const {
+		Affine2D result;
+		result.x_axis = ApplyToDirection(other.x_axis);
+		result.y_axis = ApplyToDirection(other.y_axis);
+		result.translation = Apply(other.translation);
+		return result;
+	}
+
+	vec2 x_axis;
+	vec2 y_axis;
+	vec2 translation;
+};
+
 struct TransformData {
 	TransformData()
 		: origin(vec2(0, 0)),
 		position(vec3(0, 0, 0)),
 		scale(vec2(1, 1)),
-		orientation(quat::identity) {}
+		orientation(quat::identity),
+		dirty(true),
+		parent(corgi::kInvalidEntityId) {}
 
+	// Relative to the parent, if there is one.  (Except for position.z(),
+	// which is the draw layer, and isn't inherited.)
 	vec2 origin;
 	vec3 position;
 	vec2 scale;
 	quat orientation;
 
-	mat4 GetTransformMatrix() {
-		// Start with origin transform:
-
-		mat3 rot = orientation.ToMatrix();
-
-		// Break it up into columns:
-		vec4 c0 = vec4(rot[0], rot[3], rot[6], 0);
-		vec4 c1 = vec4(rot[1], rot[4], rot[7], 0);
-		vec4 c2 = vec4(rot[2], rot[5], rot[8], 0);
-		vec4 c3 = vec4(0, 0, 0, 1);
-		// Apply scale:
-		c0 *= scale.x();
-		c1 *= scale.y();
-		//c2 *= scale.z();
-
-		
-		// Apply translation:
-		c3[0] = position.x();
-		c3[1] = position.y();
-		c3[2] = position.z();
-		
-		// Compose and return result:
-		return mat4(c0, c1, c2, c3);
+	// Cached by TransformSystem, each update, from the fields above.  Anything
+	// that changes them after the entity is created has to set dirty, or the
+	// change won't show.  (New transforms start out dirty.)
+	Affine2D world_transform;
+	bool dirty;
+
+	// Read only.  Set with TransformSystem::SetParent.
+	corgi::Entity parent;
+
+	// This transform on its own, without its parent's.  Only the rotation
+	// about z matters in 2D, so this is just the top left of the
+	// quaternion's rotation matrix.  (Same orientation as the 4x4 sprites
+	// used to be drawn with.)
+	Affine2D LocalTransform() const {
+		const vec3& v = orientation.vector();
+		float s = orientation.scalar();
+		float x2 = v.x() * v.x(), y2 = v.y() * v.y(), z2 = v.z() * v.z();
+		float xy = v.x() * v.y(), sz = s * v.z();
+		Affine2D local;
+		local.x_axis = vec2(1 - 2 * (y2 + z2), 2 * (xy - sz)) * scale.x();
+		local.y_axis = vec2(2 * (xy + sz), 1 - 2 * (x2 + z2)) * scale.y();
+		local.translation = position.xy();
+		return local;
 	}
 };
 
@@ -51,7 +84,63 @@ public:
 
 	//virtual void InitEntity(corgi::Entity entity);
 	virtual void Init();
+	virtual void CleanupEntity(corgi::Entity entity);
+
+	// Attaches child to parent, (or detaches it, if parent is
+	// corgi::kInvalidEntityId) so its transform is relative to parent's from
+	// then on.  Costs O(size of child's subtree), however many transforms
+	// there are.  Deleting a parent deletes its children too.
+	//
+	// Like adding components, this has to happen outside of system updates.
+	// (In a command buffer's CreateEntity init, for instance.)
+	void SetParent(corgi::Entity child, corgi::Entity parent);
+
+	// Works out an entity's world transform from scratch, from its own fields
+	// and its ancestors'.  For when the cached one, from the last update,
+	// is a frame stale.
+	Affine2D ComputeWorldTransform(corgi::Entity entity);
+
+private:
+	// Where an entity sits in the hierarchy.  Only entities that have been
+	// given a parent, or have children, have one.
+	struct HierarchyNode {
+		HierarchyNode()
+			: entity(corgi::kInvalidEntityId),
+			parent(corgi::kInvalidEntityId),
+			first_child(corgi::kInvalidEntityId),
+			next_sibling(corgi::kInvalidEntityId),
+			prev_sibling(corgi::kInvalidEntityId),
+			depth(0),
+			level_index(0) {}
+
+		corgi::Entity entity;
+		corgi::Entity parent;
+		corgi::Entity first_child;
+		corgi::Entity next_sibling;
+		corgi::Entity prev_sibling;
+		// 0 for roots.  Anything deeper is in levels_[depth - 1], at
+		// level_index.
+		int depth;
+		size_t level_index;
+	};
+
+	struct HierarchyLink {
+		corgi::Entity entity;
+		corgi::Entity parent;
+	};
+
+	HierarchyNode* FindNode(corgi::Entity entity);
+	HierarchyNode* AddNode(corgi::Entity entity);
+	void Unlink(HierarchyNode* node);
+	void SetDepth(corgi::Entity entity, int depth);
+
+	// Indexed by corgi::EntityIndex.
+	std::vector<HierarchyNode> nodes_;
 
+	// Every child, sorted by depth:  levels_[0] is everything whose parent is
+	// a root, and so on.  Each level only depends on the ones before it, so
+	// world transforms propagate down them in order, one flat array at a time.
+	std::vector<std::vector<HierarchyLink>> levels_;
 };
 
 CORGI_REGISTER_SYSTEM(TransformData, TransformSystem)
@@ -3,6 +3,7 @@
 #include "common.h"
 #include "transform.h"
 #include "physics.h"
+#include "physics_kernels.h"
 #include "wallbounce.h"
 
 
@@ -11,28 +12,17 @@ CORGI_DEFINE_SYSTEM(WallBounceSystem, WallBounceData)
 void WallBounceSystem::UpdateAllEntities(corgi::WorldTime delta_time) {
   CommonComponent* common = entity_manager_->GetSystem<CommonSystem>()->CommonData();
 
-  for (auto itr = begin(); itr != end(); ++itr) {
-    corgi::Entity entity = itr->entity; 
-    TransformData* transform = Data<TransformData>(entity);
-    PhysicsData* physics = Data<PhysicsData>(entity);
-
-    if (transform->position.x() < 0) {
-      transform->position.x() = 0;
-      if (physics->velocity.x() < 0) physics->velocity.x() *= -1;
-    }
-    if (transform->position.y() < 0) {
-      transform->position.y() = 0;
-      if (physics->velocity.y() < 0) physics->velocity.y() *= -1;
-    }
-    if (transform->position.x() >= common->screen_size.x()) {
-      transform->position.x() = common->screen_size.x() - 1.0f;
-      if (physics->velocity.x() > 0) physics->velocity.x() *= -1;
-    }
-    if (transform->position.y() >= common->screen_size.y()) {
-      transform->position.y() = common->screen_size.y() - 1.0f;
-      if (physics->velocity.y() > 0) physics->velocity.y() *= -1;
-    }
-  }
+  query_.Update(entity_manager_);
+  TransformData* const* transforms = query_.Column<TransformData>();
+  const PhysicsSystem::Pointer* physics_data = query_.Column<PhysicsData>();
+  vec2 screen_size = common->screen_size;
+  // Reached through the physics system's columns, rather than one proxy at
+  // a time.
+  vec2* velocities = GetSystem<PhysicsSystem>()->velocities();
+  ParallelFor(query_.size(), [=](size_t begin, size_t end) {
+    BounceOffWalls(transforms + begin, physics_data + begin, velocities,
+                   screen_size, end - begin);
+  });
 }
 
 void WallBounceSystem::DeclareDependencies() {
@@ -41,5 +31,6 @@ void WallBounceSystem::DeclareDependencies() {
 	DependOn<PhysicsData>(corgi::kExecuteAfter,
       corgi::kReadWriteAccess, corgi::kAutoAdd);
 	SetIsThreadSafe(true);
+	SetParallelChunkSize(512);
 }
 
@@ -1,7 +1,10 @@
 #ifndef WALLBOUNCE_H
 #define WALLBOUNCE_H
+#include "corgi/query.h"
 #include "corgi/system.h"
 #include "math_common.h"
+#include "physics.h"
+#include "transform.h"
 
 struct WallBounceData {
 };
@@ -13,6 +16,9 @@ public:
   virtual void UpdateAllEntities(corgi::WorldTime delta_time);
 
   virtual void DeclareDependencies();
+
+private:
+  corgi::Query<WallBounceData, TransformData, PhysicsData> query_;
 };
 
 CORGI_REGISTER_SYSTEM(WallBounceSystem, WallBounceData)
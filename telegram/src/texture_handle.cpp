@@ -0,0 +1,62 @@
+#include "texture_handle.h"
+#include <SDL.h>
+#include <assert.h>
+#include <deque>
+#include <map>
+#include <string>
+
+namespace {
+
+// Paths are kept in a deque, so the strings never move, and TexturePath's
+// pointers stay good.
+struct TextureRegistry {
+  TextureRegistry() : mutex(SDL_CreateMutex()) {
+    paths.push_back("");
+  }
+
+  SDL_mutex* mutex;
+  std::deque<std::string> paths;
+  std::map<std::string, TextureHandle> handles;
+};
+
+TextureRegistry& Registry() {
+  static TextureRegistry registry;
+  return registry;
+}
+
+}  // namespace
+
+TextureHandle InternTexture(const char* path) {
+  TextureRegistry& registry = Registry();
+  SDL_LockMutex(registry.mutex);
+  TextureHandle handle;
+  std::map<std::string, TextureHandle>::iterator itr =
+      registry.handles.find(path);
+  if (itr != registry.handles.end()) {
+    handle = itr->second;
+  } else {
+    assert(registry.paths.size() <= UINT16_MAX);
+    handle = static_cast<TextureHandle>(registry.paths.size());
+    registry.paths.push_back(path);
+    registry.handles[path] = handle;
+  }
+  SDL_UnlockMutex(registry.mutex);
+  return handle;
+}
+
+const char* TexturePath(TextureHandle texture) {
+  TextureRegistry& registry = Registry();
+  SDL_LockMutex(registry.mutex);
+  assert(texture < registry.paths.size());
+  const char* path = registry.paths[texture].c_str();
+  SDL_UnlockMutex(registry.mutex);
+  return path;
+}
+
+size_t TextureHandleCount() {
+  TextureRegistry& registry = Registry();
+  SDL_LockMutex(registry.mutex);
+  size_t count = registry.paths.size();
+  SDL_UnlockMutex(registry.mutex);
+  return count;
+}
@@ -0,0 +1,28 @@
+#ifndef TEXTURE_HANDLE_H
+#define TEXTURE_HANDLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Textures are named by path, but everything past loading refers to them by
+// handle:  a small integer, handed out the first time a path is interned,
+// and the same for every copy of that path, wherever the string lives.  So
+// a handle can index straight into an array, and comparing two is just
+// comparing ints.
+typedef uint16_t TextureHandle;
+
+// No texture at all.  Never handed out for a path.
+const TextureHandle kNoTexture = 0;
+
+// Returns path's handle, adding it if it's new.  Safe to call from any
+// thread, but it takes a lock and does a string lookup, so resolve handles
+// once (at spawn, or into a static) rather than every frame.
+TextureHandle InternTexture(const char* path);
+
+// The path a handle was interned from.  ("" for kNoTexture.)
+const char* TexturePath(TextureHandle texture);
+
+// One more than the largest handle handed out so far.
+size_t TextureHandleCount();
+
+#endif // TEXTURE_HANDLE_H
@@ -1,16 +1,22 @@
 #include "texture_manager.h"
 #include <SDL.h>
 #include <SDL_image.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "atlas_packer.h"
 
 
 TextureManager::TextureManager() {
-  texture_directory.clear();
+  textures.clear();
 }
 
-GLuint TextureManager::GetTexture(const char* path) {
-  if (texture_directory.find(path) != texture_directory.end()) {
-    return texture_directory[path];
+GLuint TextureManager::GetTexture(TextureHandle texture) {
+  if (texture == kNoTexture) return 0;
+  if (texture < textures.size() && textures[texture] != 0) {
+    return textures[texture];
   } else {
+    const char* path = TexturePath(texture);
     GLuint new_texture_id = 0;
     SDL_Surface* surface = IMG_Load(path);
 
@@ -31,7 +37,8 @@ GLuint TextureManager::GetTexture(const char* path) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    texture_directory[path] = new_texture_id;
+    if (textures.size() <= texture) textures.resize(texture + 1, 0);
+    textures[texture] = new_texture_id;
     return new_texture_id;
   }
 }
@@ -39,9 +46,185 @@ GLuint TextureManager::GetTexture(const char* path) {
 
 void TextureManager::ClearAllTextures() {
 
-  for (std::map<std::string, GLuint>::iterator itr = texture_directory.begin();
-      itr != texture_directory.end(); ++itr) {
-    glDeleteTextures(1, &itr->second);
+  for (size_t i = 0; i < textures.size(); i++) {
+    if (textures[i] != 0) glDeleteTextures(1, &textures[i]);
   }
-  texture_directory.clear();
+  textures.clear();
+
+  if (!atlas_pages.empty()) {
+    glDeleteTextures(static_cast<GLsizei>(atlas_pages.size()),
+        atlas_pages.data());
+  }
+  atlas_pages.clear();
+  atlas_regions.clear();
+  atlas_queue.clear();
+}
+
+void TextureManager::AddToAtlas(TextureHandle texture) {
+  atlas_queue.push_back(texture);
+}
+
+namespace {
+
+// An image on its way into the atlas.
+struct AtlasImage {
+  TextureHandle texture;
+  SDL_Surface* surface;
+  int page;
+  int x;
+  int y;
+};
+
+bool TallerThan(const AtlasImage& a, const AtlasImage& b) {
+  return a.surface->h > b.surface->h;
+}
+
+// Copies the outermost pixels of the width x height image at (x, y) out
+// into the border padding pixels wide all round it.  So linear filtering at
+// the image's edge only ever blends it with copies of itself, the same as
+// clamping would if it had a texture of its own.
+void ExtrudeEdges(Uint8* pixels, int page_size, int x, int y, int width,
+    int height, int padding) {
+  const size_t kPixelSize = 4;
+  // Out to the sides, row by row...
+  for (int row = y; row < y + height; row++) {
+    Uint8* line = pixels + row * page_size * kPixelSize;
+    for (int i = 1; i <= padding; i++) {
+      memcpy(line + (x - i) * kPixelSize, line + x * kPixelSize, kPixelSize);
+      memcpy(line + (x + width - 1 + i) * kPixelSize,
+          line + (x + width - 1) * kPixelSize, kPixelSize);
+    }
+  }
+  // ...then the top and bottom rows, corners and all, up and down.
+  size_t span = (width + padding * 2) * kPixelSize;
+  Uint8* top = pixels + (y * page_size + x - padding) * kPixelSize;
+  Uint8* bottom = pixels +
+      ((y + height - 1) * page_size + x - padding) * kPixelSize;
+  for (int i = 1; i <= padding; i++) {
+    memcpy(top - i * page_size * kPixelSize, top, span);
+    memcpy(bottom + i * page_size * kPixelSize, bottom, span);
+  }
+}
+
+}  // namespace
+
+void TextureManager::BuildAtlas(int page_size, int padding) {
+  // Every image is converted to 8-bit RGBA, in that order in memory,
+  // whatever it was in the file.
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+  const Uint32 kRGBAFormat = SDL_PIXELFORMAT_RGBA8888;
+#else
+  const Uint32 kRGBAFormat = SDL_PIXELFORMAT_ABGR8888;
+#endif
+
+  std::vector<AtlasImage> images;
+  for (size_t i = 0; i < atlas_queue.size(); i++) {
+    TextureHandle texture = atlas_queue[i];
+    if (FindRegion(texture) != nullptr) continue;
+
+    const char* path = TexturePath(texture);
+    SDL_Surface* loaded = IMG_Load(path);
+    if (loaded == nullptr) {
+      printf("Unable to load image %s! SDL_image Error: %s\n", path,
+          IMG_GetError());
+      continue;
+    }
+    SDL_Surface* surface = SDL_ConvertSurfaceFormat(loaded, kRGBAFormat, 0);
+    SDL_FreeSurface(loaded);
+    if (surface == nullptr) {
+      printf("Unable to convert image %s! SDL Error: %s\n", path,
+          SDL_GetError());
+      continue;
+    }
+
+    AtlasImage image = { texture, surface, -1, 0, 0 };
+    images.push_back(image);
+  }
+  atlas_queue.clear();
+
+  // Tallest first packs tightest.  Each image goes on the first page it
+  // fits on, or a new one, with a border padding pixels wide all round.
+  std::stable_sort(images.begin(), images.end(), TallerThan);
+  std::vector<SkylinePacker> packers;
+  for (size_t i = 0; i < images.size(); i++) {
+    AtlasImage& image = images[i];
+    int width = image.surface->w + padding * 2;
+    int height = image.surface->h + padding * 2;
+    for (size_t page = 0; page < packers.size(); page++) {
+      if (packers[page].Pack(width, height, &image.x, &image.y)) {
+        image.page = static_cast<int>(page);
+        break;
+      }
+    }
+    if (image.page < 0) {
+      SkylinePacker packer(page_size, page_size);
+      if (packer.Pack(width, height, &image.x, &image.y)) {
+        packers.push_back(packer);
+        image.page = static_cast<int>(packers.size()) - 1;
+      } else {
+        printf("Image %s is too big for a %d pixel atlas page!\n",
+            TexturePath(image.texture), page_size);
+      }
+    }
+    if (image.page >= 0) {
+      // From here on, (x, y) is the image itself, inside its border.
+      image.x += padding;
+      image.y += padding;
+    }
+  }
+
+  // Each page is put together here, then uploaded in one go.  Every
+  // image's border is filled with copies of its edge, so its UVs can go
+  // right up to the edge without picking up anything else on the page.
+  std::vector<Uint8> pixels;
+  float texel = 1.0f / page_size;
+  for (size_t page = 0; page < packers.size(); page++) {
+    GLuint page_texture = 0;
+    glGenTextures(1, &page_texture);
+
+    pixels.assign(page_size * page_size * 4, 0);
+    for (size_t i = 0; i < images.size(); i++) {
+      const AtlasImage& image = images[i];
+      if (image.page != static_cast<int>(page)) continue;
+
+      SDL_Surface* surface = image.surface;
+      SDL_LockSurface(surface);
+      for (int row = 0; row < surface->h; row++) {
+        memcpy(&pixels[((image.y + row) * page_size + image.x) * 4],
+            static_cast<const Uint8*>(surface->pixels) + row * surface->pitch,
+            surface->w * 4);
+      }
+      SDL_UnlockSurface(surface);
+      ExtrudeEdges(pixels.data(), page_size, image.x, image.y, surface->w,
+          surface->h, padding);
+
+      TextureRegion region;
+      region.texture = page_texture;
+      region.uv = vec4(image.x * texel, image.y * texel,
+          (image.x + surface->w) * texel, (image.y + surface->h) * texel);
+      if (atlas_regions.size() <= image.texture) {
+        atlas_regions.resize(image.texture + 1);
+      }
+      atlas_regions[image.texture] = region;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, page_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, page_size, page_size, 0, GL_RGBA,
+        GL_UNSIGNED_BYTE, pixels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    atlas_pages.push_back(page_texture);
+  }
+
+  for (size_t i = 0; i < images.size(); i++) {
+    SDL_FreeSurface(images[i].surface);
+  }
+}
+
+const TextureRegion* TextureManager::FindRegion(TextureHandle texture) const {
+  if (texture >= atlas_regions.size()) return nullptr;
+  const TextureRegion& region = atlas_regions[texture];
+  return region.texture != 0 ? &region : nullptr;
 }
\ No newline at end of file
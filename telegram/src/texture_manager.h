@@ -3,8 +3,8 @@
 
 #include "mathfu/glsl_mappings.h"
 #include "GL/glew.h"
-#include <map>
-#include <string>
+#include <vector>
+#include "texture_handle.h"
 
 using mathfu::quat;
 using mathfu::vec2;
@@ -14,19 +14,53 @@ using mathfu::mat3;
 using mathfu::mat4;
 
 
+// Where an image is packed in the atlas:  which page, and the part of it,
+// as (u0, v0, u1, v1).
+struct TextureRegion {
+  TextureRegion() : texture(0), uv(0, 0, 1, 1) {}
+
+  GLuint texture;
+  vec4 uv;
+};
+
 // Basic texture manager class, so don't
 // end up loading the same thing more than once.
+//
+// Images can also be packed together into shared atlas pages, so sprites
+// using any of them can be drawn together.
 class TextureManager {
 public:
   TextureManager();
 
-  GLuint GetTexture(const char* path);
+  // The whole texture for an image, loading it if need be.  (For an image
+  // in the atlas, that's a texture of its own, separate from its page.)
+  // Once it's loaded, this is just an array lookup.
+  GLuint GetTexture(TextureHandle texture);
   void ClearAllTextures();
 
-private:
-  std::map<std::string, GLuint> texture_directory;
+  // Queues an image to go in the atlas, at the next BuildAtlas.
+  void AddToAtlas(TextureHandle texture);
 
+  // Loads every queued image, and packs them into as few new page_size
+  // square pages as will hold them, each with a border padding pixels wide
+  // that repeats its edge pixels.  Anything too big for a page is left out.
+  // Needs a GL context.
+  void BuildAtlas(int page_size = 1024, int padding = 2);
+
+  // Where an image is in the atlas, or nullptr if it isn't in it.  Doesn't
+  // load anything or touch GL, so it's safe to call from system updates.
+  const TextureRegion* FindRegion(TextureHandle texture) const;
+
+  size_t atlas_page_count() const { return atlas_pages.size(); }
+
+private:
+  // Indexed by handle.  0 for ones that haven't been loaded, or aren't in
+  // the atlas.
+  std::vector<GLuint> textures;
+  std::vector<TextureRegion> atlas_regions;
 
+  std::vector<TextureHandle> atlas_queue;
+  std::vector<GLuint> atlas_pages;
 };
 
 #endif // TEXTURE_MANAGER_H
\ No newline at end of file
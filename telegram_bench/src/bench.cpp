@@ -0,0 +1,123 @@
+#include "bench.h"
+#include <SDL.h>
+#include <stdio.h>
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+
+void FrameStats::AddSample(double milliseconds, size_t entity_count) {
+  Sample sample;
+  sample.milliseconds = milliseconds;
+  sample.entity_count = entity_count;
+  samples_.push_back(sample);
+}
+
+double FrameStats::Percentile(double p) const {
+  if (samples_.empty()) return 0.0;
+  std::vector<double> sorted;
+  sorted.reserve(samples_.size());
+  for (size_t i = 0; i < samples_.size(); i++) {
+    sorted.push_back(samples_[i].milliseconds);
+  }
+  std::sort(sorted.begin(), sorted.end());
+
+  size_t rank = static_cast<size_t>(p / 100.0 * sorted.size() + 0.5);
+  if (rank < 1) rank = 1;
+  if (rank > sorted.size()) rank = sorted.size();
+  return sorted[rank - 1];
+}
+
+double FrameStats::Total() const {
+  double total = 0.0;
+  for (size_t i = 0; i < samples_.size(); i++) {
+    total += samples_[i].milliseconds;
+  }
+  return total;
+}
+
+double FrameStats::Mean() const {
+  return samples_.empty() ? 0.0 : Total() / samples_.size();
+}
+
+double FrameStats::EntitiesPerSecond() const {
+  double total_ms = Total();
+  if (total_ms <= 0.0) return 0.0;
+  double entity_updates = 0.0;
+  for (size_t i = 0; i < samples_.size(); i++) {
+    entity_updates += samples_[i].entity_count;
+  }
+  return entity_updates / (total_ms / 1000.0);
+}
+
+size_t FrameStats::MaxEntityCount() const {
+  size_t result = 0;
+  for (size_t i = 0; i < samples_.size(); i++) {
+    result = std::max(result, samples_[i].entity_count);
+  }
+  return result;
+}
+
+double FrameStats::MeanEntityCount() const {
+  if (samples_.empty()) return 0.0;
+  double total = 0.0;
+  for (size_t i = 0; i < samples_.size(); i++) {
+    total += samples_[i].entity_count;
+  }
+  return total / samples_.size();
+}
+
+void FrameStats::PrintReport(const char* label) const {
+  printf("%s (%d frames)\n", label, static_cast<int>(samples_.size()));
+  printf("  ms/frame    min %8.3f  p50 %8.3f  p90 %8.3f  p99 %8.3f  max %8.3f  mean %8.3f\n",
+      Percentile(0), Percentile(50), Percentile(90), Percentile(99),
+      Percentile(100), Mean());
+  printf("  entities    mean %10.1f  max %10d\n", MeanEntityCount(),
+      static_cast<int>(MaxEntityCount()));
+  printf("  entities/s  %.0f\n", EntitiesPerSecond());
+}
+
+bool FrameStats::WriteCsv(const char* path) const {
+  FILE* file = fopen(path, "w");
+  if (file == nullptr) {
+    printf("Unable to open %s for writing!\n", path);
+    return false;
+  }
+  fprintf(file, "frame,ms,entities\n");
+  for (size_t i = 0; i < samples_.size(); i++) {
+    fprintf(file, "%d,%.6f,%d\n", static_cast<int>(i),
+        samples_[i].milliseconds, static_cast<int>(samples_[i].entity_count));
+  }
+  fclose(file);
+  return true;
+}
+
+double BenchNowMs() {
+  static const double kFrequency =
+      static_cast<double>(SDL_GetPerformanceFrequency());
+  return static_cast<double>(SDL_GetPerformanceCounter()) * 1000.0 / kFrequency;
+}
+
+size_t PeakMemoryBytes() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return counters.PeakWorkingSetSize;
+  }
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+  return static_cast<size_t>(usage.ru_maxrss);
+#else
+  // Linux reports this in kilobytes.
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
@@ -0,0 +1,92 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <vector>
+#include <string>
+#include "corgi/job_pool.h"
+
+// Options shared by every benchmark scenario.  Filled in from the
+// command line by bench_main.cpp.
+struct BenchOptions {
+  BenchOptions()
+    : frames(600),
+      warmup_frames(60),
+      worker_threads(corgi::JobPool::kDefaultWorkerCount),
+      seed(1),
+      delta_time(1000 / 60),
+      asteroids(50),
+      bullets(200),
+      exhaust(500),
+      debris(500),
+      sprites(100000) {}
+
+  int frames;
+  int warmup_frames;
+  int worker_threads;
+  unsigned int seed;
+  double delta_time;
+
+  // Target populations for the frame scenario.  These are topped back
+  // up after every frame, so the simulation stays at a steady state
+  // even though bullets and particles die off on their own.
+  int asteroids;
+  int bullets;
+  int exhaust;
+  int debris;
+
+  // Population for the sprite-only scenarios.
+  int sprites;
+
+  // Optional scripted input file.  (See input_script.h for the format.)
+  std::string input_script_path;
+
+  // Optional path to dump per-frame timings to, as CSV.
+  std::string csv_path;
+
+  // Optional path to write a Chrome trace of the scheduler to.  Also
+  // prints the per-system timing table.
+  std::string trace_path;
+};
+
+// Collects per-frame timings and reports percentiles.
+class FrameStats {
+public:
+  void AddSample(double milliseconds, size_t entity_count);
+
+  // Nearest-rank percentile, p in [0, 100].
+  double Percentile(double p) const;
+  double Mean() const;
+  double Total() const;
+  size_t SampleCount() const { return samples_.size(); }
+
+  // Entities updated per second of update time, across all samples.
+  double EntitiesPerSecond() const;
+  size_t MaxEntityCount() const;
+  double MeanEntityCount() const;
+
+  void PrintReport(const char* label) const;
+  bool WriteCsv(const char* path) const;
+
+private:
+  struct Sample {
+    double milliseconds;
+    size_t entity_count;
+  };
+  std::vector<Sample> samples_;
+};
+
+// Returns a high-resolution timestamp in milliseconds.
+double BenchNowMs();
+
+// Returns the peak resident set size of the process, in bytes, or 0 if
+// the platform doesn't tell us.
+size_t PeakMemoryBytes();
+
+// Scenarios:
+int RunFrameScenario(const BenchOptions& options);
+int RunSpriteScenario(const BenchOptions& options);
+int RunSpriteLayoutScenario(const BenchOptions& options);
+
+
+#endif // BENCH_H
@@ -0,0 +1,115 @@
+// Headless benchmark driver.  Runs the game's update loop (and pieces of
+// it) with no window, no GL context, and no frame throttling, and reports
+// how long each frame took.
+//
+// usage: telegram_bench [scenario] [--option value ...]
+//        telegram_bench --help
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+
+struct Scenario {
+  const char* name;
+  const char* description;
+  int (*run)(const BenchOptions& options);
+};
+
+static const Scenario kScenarios[] = {
+  { "frame", "Full MainState update loop with steady-state populations.",
+      RunFrameScenario },
+  { "sprites", "Transform and sprite batching for --sprites sprites.",
+      RunSpriteScenario },
+  { "sprite_layouts", "Sprite batch fill time and size, per vertex layout.",
+      RunSpriteLayoutScenario },
+};
+static const int kScenarioCount = sizeof(kScenarios) / sizeof(kScenarios[0]);
+
+static void PrintUsage() {
+  printf("usage: telegram_bench [scenario] [options]\n\n");
+  printf("scenarios:\n");
+  for (int i = 0; i < kScenarioCount; i++) {
+    printf("  %-14s %s\n", kScenarios[i].name, kScenarios[i].description);
+  }
+  printf("\noptions:\n");
+  printf("  --frames N       timed frames (default 600)\n");
+  printf("  --warmup N       untimed frames before measuring (default 60)\n");
+  printf("  --threads N      corgi worker threads (default: cores - 1)\n");
+  printf("  --seed N         random seed (default 1)\n");
+  printf("  --dt N           delta time passed to each update (default 16)\n");
+  printf("  --asteroids N    asteroid population (default 50)\n");
+  printf("  --bullets N      bullet population (default 200)\n");
+  printf("  --exhaust N      exhaust particle population (default 500)\n");
+  printf("  --debris N       debris particle population (default 500)\n");
+  printf("  --sprites N      sprite count for sprite scenarios (default 100000)\n");
+  printf("  --input PATH     input script (default: built-in script)\n");
+  printf("  --csv PATH       write per-frame timings to PATH\n");
+  printf("  --trace PATH     write a Chrome trace of the scheduler to PATH\n");
+}
+
+// Returns true if argv[*i] was a recognized option, consuming its value.
+static bool ParseOption(int argc, char* argv[], int* i, BenchOptions* options) {
+  const char* name = argv[*i];
+  if (*i + 1 >= argc) return false;
+  const char* value = argv[*i + 1];
+
+  if (strcmp(name, "--frames") == 0) options->frames = atoi(value);
+  else if (strcmp(name, "--warmup") == 0) options->warmup_frames = atoi(value);
+  else if (strcmp(name, "--threads") == 0) options->worker_threads = atoi(value);
+  else if (strcmp(name, "--seed") == 0) options->seed = static_cast<unsigned int>(atoi(value));
+  else if (strcmp(name, "--dt") == 0) options->delta_time = atof(value);
+  else if (strcmp(name, "--asteroids") == 0) options->asteroids = atoi(value);
+  else if (strcmp(name, "--bullets") == 0) options->bullets = atoi(value);
+  else if (strcmp(name, "--exhaust") == 0) options->exhaust = atoi(value);
+  else if (strcmp(name, "--debris") == 0) options->debris = atoi(value);
+  else if (strcmp(name, "--sprites") == 0) options->sprites = atoi(value);
+  else if (strcmp(name, "--input") == 0) options->input_script_path = value;
+  else if (strcmp(name, "--csv") == 0) options->csv_path = value;
+  else if (strcmp(name, "--trace") == 0) options->trace_path = value;
+  else return false;
+
+  (*i)++;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  BenchOptions options;
+  const Scenario* scenario = &kScenarios[0];
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+      PrintUsage();
+      return 0;
+    }
+    if (argv[i][0] != '-') {
+      scenario = nullptr;
+      for (int j = 0; j < kScenarioCount; j++) {
+        if (strcmp(argv[i], kScenarios[j].name) == 0) scenario = &kScenarios[j];
+      }
+      if (scenario == nullptr) {
+        printf("Unknown scenario: %s\n\n", argv[i]);
+        PrintUsage();
+        return 1;
+      }
+      continue;
+    }
+    if (!ParseOption(argc, argv, &i, &options)) {
+      printf("Bad option: %s\n\n", argv[i]);
+      PrintUsage();
+      return 1;
+    }
+  }
+
+  // Timers only - no video, no window, no GL.
+  if (SDL_Init(SDL_INIT_TIMER) < 0) {
+    printf("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
+    return 1;
+  }
+
+  int result = scenario->run(options);
+
+  SDL_Quit();
+  return result;
+}
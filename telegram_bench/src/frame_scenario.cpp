@@ -0,0 +1,154 @@
+#include "bench.h"
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <iterator>
+#include "constants.h"
+#include "math_common.h"
+#include "input_script.h"
+#include "states/main_state.h"
+
+// The full game update loop, run headless:  MainState with no window,
+// driven by an input script, with steady-state populations of asteroids,
+// bullets, exhaust and debris.
+
+template <typename T>
+static int ComponentCount(T* system) {
+  return static_cast<int>(std::distance(system->begin(), system->end()));
+}
+
+static void SpawnAsteroid(corgi::EntityManager* entity_manager) {
+  corgi::Entity asteroid = entity_manager->AllocateNewEntity();
+  entity_manager->AddComponent<AsteroidSystem>(asteroid);
+
+  float radius = 10.0f + rnd() * 30.0f;
+  AsteroidData* asteroid_data =
+      entity_manager->GetComponentData<AsteroidData>(asteroid);
+  asteroid_data->radius = radius;
+  asteroid_data->hp = radius * kHpScale;
+  entity_manager->GetComponentData<ColliderData>(asteroid)->radius = radius;
+  entity_manager->GetComponentData<TransformData>(asteroid)->scale =
+      vec2(radius * 2.0f, radius * 2.0f);
+}
+
+static void SpawnBullet(corgi::EntityManager* entity_manager) {
+  corgi::Entity bullet = entity_manager->AllocateNewEntity();
+  entity_manager->AddComponent<BulletSystem>(bullet);
+
+  float angle = rnd() * 2.0f * static_cast<float>(M_PI);
+  entity_manager->GetComponentData<PhysicsData>(bullet)->velocity =
+      vec2(cosf(angle), sinf(angle)) * 10.0f;
+}
+
+// Same as PlayerShip::SpawnExhaust and AsteroidSystem::SpawnDebris, but
+// scattered over the whole screen.
+static void SpawnParticle(ParticlePool* pool, float size, float lifetime,
+    float fade_point, vec4 tint) {
+  vec2 position = vec2(rnd() * kScreenWidth, rnd() * kScreenHeight);
+  vec2 velocity = vec2(rnd() * 5.0f - 2.5f, rnd() * 5.0f - 2.5f);
+  pool->Spawn(position, velocity, size, tint, lifetime, fade_point);
+}
+
+static void SpawnExhaust(ParticlePool* pool) {
+  SpawnParticle(pool, 10.0f, 500.0f, 500.0f, vec4(1, 1, 0, 1));
+}
+
+static void SpawnDebris(ParticlePool* pool) {
+  SpawnParticle(pool, 20.0f, 100.0f + 50.0f * rnd(), 100.0f,
+      vec4(0.5f + rnd(), 0.5f + rnd(), 0.5f + rnd(), 1));
+}
+
+int RunFrameScenario(const BenchOptions& options) {
+  InputScript input_script;
+  if (options.input_script_path.empty()) {
+    input_script.MakeDefault();
+  } else if (!input_script.LoadFromFile(options.input_script_path.c_str())) {
+    return 1;
+  }
+
+  std::srand(options.seed);
+
+  // The trace has to outlive the entity manager's worker threads.
+  corgi::SchedulerTrace scheduler_trace;
+  MainState main_state(nullptr, nullptr, nullptr, kScreenWidth, kScreenHeight);
+  main_state.set_worker_thread_count(options.worker_threads);
+  bool tracing = !options.trace_path.empty();
+  if (tracing) main_state.entity_manager()->set_scheduler_trace(&scheduler_trace);
+  main_state.Init();
+
+  corgi::EntityManager* entity_manager = main_state.entity_manager();
+  AsteroidSystem* asteroid_system = entity_manager->GetSystem<AsteroidSystem>();
+  BulletSystem* bullet_system = entity_manager->GetSystem<BulletSystem>();
+
+  ParticleSystem* particle_system =
+      entity_manager->GetSystem<ParticleSystem>();
+  ParticlePool* exhaust = particle_system->pool(kExhaustParticles);
+  ParticlePool* debris = particle_system->pool(kDebrisParticles);
+  // A full pool replaces its oldest particles, so it can't be topped up
+  // past its capacity.
+  size_t exhaust_target = std::min<size_t>(options.exhaust, exhaust->capacity());
+  size_t debris_target = std::min<size_t>(options.debris, debris->capacity());
+
+  FrameStats stats;
+  int spawned = 0;
+  int particles_spawned = 0;
+
+  int total_frames = options.warmup_frames + options.frames;
+  for (int frame = 0; frame < total_frames; frame++) {
+    // Top the populations back up.  This happens outside of the timed
+    // region, but the structural changes it makes are merged in (and
+    // timed) during the next update.
+    for (int i = ComponentCount(asteroid_system); i < options.asteroids; i++) {
+      SpawnAsteroid(entity_manager);
+      spawned++;
+    }
+    for (int i = ComponentCount(bullet_system); i < options.bullets; i++) {
+      SpawnBullet(entity_manager);
+      spawned++;
+    }
+    while (exhaust->live_count() < exhaust_target) {
+      SpawnExhaust(exhaust);
+      particles_spawned++;
+    }
+    while (debris->live_count() < debris_target) {
+      SpawnDebris(debris);
+      particles_spawned++;
+    }
+
+    if (tracing && frame == options.warmup_frames) {
+      scheduler_trace.StartCapture(options.frames);
+    }
+
+    input_script.Apply(frame, main_state.keyboard_input());
+
+    size_t entity_count = entity_manager->EntityCount();
+    double start = BenchNowMs();
+    main_state.Update(options.delta_time);
+    double elapsed = BenchNowMs() - start;
+
+    if (frame >= options.warmup_frames) {
+      stats.AddSample(elapsed, entity_count);
+    }
+  }
+
+  printf("scenario: frame\n");
+  printf("  threads %d  dt %.3f  seed %u  warmup %d\n",
+      main_state.entity_manager()->job_pool()->thread_count() - 1,
+      options.delta_time, options.seed, options.warmup_frames);
+  printf("  targets     asteroids %d  bullets %d  exhaust %d  debris %d\n",
+      options.asteroids, options.bullets, options.exhaust, options.debris);
+  printf("  spawned     %d entities, %d particles (outside the timed region)\n",
+      spawned, particles_spawned);
+  stats.PrintReport("update");
+  printf("  peak memory %.1f MB\n", PeakMemoryBytes() / (1024.0 * 1024.0));
+
+  if (!options.csv_path.empty() && !stats.WriteCsv(options.csv_path.c_str())) {
+    return 1;
+  }
+  if (tracing) {
+    scheduler_trace.PrintSystemTable(stdout);
+    if (!scheduler_trace.WriteChromeTrace(options.trace_path.c_str())) return 1;
+  }
+  return 0;
+}
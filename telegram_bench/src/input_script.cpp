@@ -0,0 +1,123 @@
+#include "input_script.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+struct KeyName {
+  const char* name;
+  SDL_Keycode key;
+};
+
+static const KeyName kKeyNames[] = {
+  { "left", SDLK_LEFT },
+  { "right", SDLK_RIGHT },
+  { "up", SDLK_UP },
+  { "down", SDLK_DOWN },
+  { "space", SDLK_SPACE },
+  { "a", SDLK_a },
+  { "d", SDLK_d },
+  { "w", SDLK_w },
+  { "s", SDLK_s },
+  { "escape", SDLK_ESCAPE },
+};
+
+static bool LookupKey(const char* name, SDL_Keycode* key) {
+  for (size_t i = 0; i < sizeof(kKeyNames) / sizeof(kKeyNames[0]); i++) {
+    if (strcmp(kKeyNames[i].name, name) == 0) {
+      *key = kKeyNames[i].key;
+      return true;
+    }
+  }
+  return false;
+}
+
+void InputScript::AddEvent(int frame, SDL_Keycode key, bool is_down) {
+  Event event;
+  event.frame = frame;
+  event.key = key;
+  event.is_down = is_down;
+  events_.push_back(event);
+}
+
+void InputScript::SortEvents() {
+  std::stable_sort(events_.begin(), events_.end(),
+      [](const Event& a, const Event& b) { return a.frame < b.frame; });
+  next_event_ = 0;
+}
+
+bool InputScript::LoadFromFile(const char* path) {
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    printf("Unable to open input script %s!\n", path);
+    return false;
+  }
+
+  events_.clear();
+  loop_length_ = 0;
+
+  char line[256];
+  int line_number = 0;
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    line_number++;
+    char* comment = strchr(line, '#');
+    if (comment != nullptr) *comment = '\0';
+
+    char first[64];
+    char key_name[64];
+    char state[64];
+    int count = sscanf(line, "%63s %63s %63s", first, key_name, state);
+    if (count <= 0) continue;
+
+    if (strcmp(first, "loop") == 0 && count >= 2) {
+      loop_length_ = atoi(key_name);
+      continue;
+    }
+
+    SDL_Keycode key;
+    if (count != 3 || !LookupKey(key_name, &key) ||
+        (strcmp(state, "down") != 0 && strcmp(state, "up") != 0)) {
+      printf("%s:%d: can't parse input script line\n", path, line_number);
+      fclose(file);
+      return false;
+    }
+    AddEvent(atoi(first), key, strcmp(state, "down") == 0);
+  }
+  fclose(file);
+
+  SortEvents();
+  return true;
+}
+
+void InputScript::MakeDefault() {
+  events_.clear();
+  loop_length_ = 240;
+
+  AddEvent(0, SDLK_SPACE, true);
+  AddEvent(0, SDLK_UP, true);
+  AddEvent(120, SDLK_UP, false);
+
+  AddEvent(60, SDLK_LEFT, true);
+  AddEvent(90, SDLK_LEFT, false);
+  AddEvent(150, SDLK_RIGHT, true);
+  AddEvent(200, SDLK_RIGHT, false);
+
+  SortEvents();
+}
+
+void InputScript::Apply(int frame, KeyboardInput* keyboard_input) {
+  if (events_.empty()) return;
+
+  int script_frame = frame;
+  if (loop_length_ > 0) {
+    script_frame = frame % loop_length_;
+    if (script_frame == 0) next_event_ = 0;
+  }
+
+  while (next_event_ < events_.size() &&
+      events_[next_event_].frame <= script_frame) {
+    keyboard_input->SetKeyState(events_[next_event_].key,
+        events_[next_event_].is_down);
+    next_event_++;
+  }
+}
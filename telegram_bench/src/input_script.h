@@ -0,0 +1,52 @@
+#ifndef INPUT_SCRIPT_H
+#define INPUT_SCRIPT_H
+
+#include <SDL.h>
+#include <vector>
+#include "keyboard_input.h"
+
+// A canned stream of key presses and releases, used to drive the player
+// ship when there's no window to get real keyboard events from.
+//
+// Script files are plain text, one event per line:
+//
+//   # comment
+//   loop 240          (optional - replay the script every 240 frames)
+//   0 space down
+//   0 up down
+//   120 up up
+//   60 left down
+//   90 left up
+//
+// Keys are: left, right, up, down, space, a, d, w, s, escape.
+class InputScript {
+public:
+  InputScript() : loop_length_(0), next_event_(0) {}
+
+  // Loads a script from disk.  Returns false (and prints why) on failure.
+  bool LoadFromFile(const char* path);
+
+  // A reasonable default:  fire constantly, thrust half of the time,
+  // and turn back and forth, so every system gets exercised.
+  void MakeDefault();
+
+  // Applies every event scheduled for the given frame.  Frames must be
+  // applied in increasing order.
+  void Apply(int frame, KeyboardInput* keyboard_input);
+
+private:
+  struct Event {
+    int frame;
+    SDL_Keycode key;
+    bool is_down;
+  };
+
+  void AddEvent(int frame, SDL_Keycode key, bool is_down);
+  void SortEvents();
+
+  std::vector<Event> events_;
+  int loop_length_;
+  size_t next_event_;
+};
+
+#endif // INPUT_SCRIPT_H
@@ -0,0 +1,161 @@
+#include "bench.h"
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "constants.h"
+#include "math_common.h"
+#include "corgi/entity_manager.h"
+#include "systems/common.h"
+#include "systems/particles.h"
+#include "systems/physics.h"
+#include "systems/sprite.h"
+#include "systems/transform.h"
+
+// Just the sprite pipeline, at scale:  a field of drifting, spinning
+// sprites over a few textures, moved by PhysicsSystem, transformed by
+// TransformSystem and batched by a headless SpriteSystem every frame.
+
+static const char* const kTextures[] = {
+  "rsc/asteroid.png",
+  "rsc/circle.png",
+  "rsc/ship.png",
+};
+static const int kTextureCount = sizeof(kTextures) / sizeof(kTextures[0]);
+
+static void SpawnSprite(corgi::EntityManager* entity_manager) {
+  corgi::Entity entity = entity_manager->AllocateNewEntity();
+  entity_manager->AddComponent<SpriteSystem>(entity);
+  entity_manager->AddComponent<PhysicsSystem>(entity);
+
+  SpriteData* sprite = entity_manager->GetComponentData<SpriteData>(entity);
+  TransformData* transform =
+      entity_manager->GetComponentData<TransformData>(entity);
+  auto physics = entity_manager->GetComponentData<PhysicsData>(entity);
+
+  float size = 10.0f + rnd() * 20.0f;
+  sprite->size = vec2(size, size);
+  sprite->tint = vec4(0.5f + rnd() * 0.5f, 0.5f + rnd() * 0.5f,
+      0.5f + rnd() * 0.5f, 1.0f);
+  sprite->texture = InternTexture(kTextures[rand() % kTextureCount]);
+  transform->origin = vec2(size / 2, size / 2);
+  transform->position =
+      vec3(rnd() * kScreenWidth, rnd() * kScreenHeight, kLayerAsteroids);
+  physics->velocity = vec2(rnd() * 2.0f - 1.0f, rnd() * 2.0f - 1.0f);
+  physics->angular_velocity =
+      quat::FromAngleAxis(rnd() * 0.1f - 0.05f, vec3(0.0f, 0.0f, 1.0f));
+}
+
+int RunSpriteScenario(const BenchOptions& options) {
+  std::srand(options.seed);
+
+  CommonSystem common_system;
+  TransformSystem transform_system;
+  SpriteSystem sprite_system;
+  PhysicsSystem physics_system;
+  ParticleSystem particle_system;
+  corgi::EntityManager entity_manager;
+
+  sprite_system.set_headless(true);
+  entity_manager.RegisterSystem(&common_system);
+  entity_manager.RegisterSystem(&transform_system);
+  entity_manager.RegisterSystem(&sprite_system);
+  entity_manager.RegisterSystem(&physics_system);
+  entity_manager.RegisterSystem(&particle_system);
+  entity_manager.set_max_worker_threads(options.worker_threads);
+  entity_manager.FinalizeSystemList();
+
+  for (int i = 0; i < options.sprites; i++) {
+    SpawnSprite(&entity_manager);
+  }
+
+  FrameStats stats;
+  int total_frames = options.warmup_frames + options.frames;
+  for (int frame = 0; frame < total_frames; frame++) {
+    size_t entity_count = entity_manager.EntityCount();
+    double start = BenchNowMs();
+    entity_manager.UpdateSystems(options.delta_time);
+    double elapsed = BenchNowMs() - start;
+    if (frame >= options.warmup_frames) {
+      stats.AddSample(elapsed, entity_count);
+    }
+  }
+
+  printf("scenario: sprites\n");
+  printf("  threads %d  dt %.3f  seed %u  warmup %d\n",
+      entity_manager.job_pool()->thread_count() - 1,
+      options.delta_time, options.seed, options.warmup_frames);
+  printf("  batched     %d sprites in %d chunks, %.1f KB of vertices\n",
+      sprite_system.sprite_count(),
+      static_cast<int>(sprite_system.chunk_count()),
+      sprite_system.vertex_bytes() / 1024.0);
+  stats.PrintReport("update");
+  printf("  peak memory %.1f MB\n", PeakMemoryBytes() / (1024.0 * 1024.0));
+
+  if (!options.csv_path.empty() && !stats.WriteCsv(options.csv_path.c_str())) {
+    return 1;
+  }
+  return 0;
+}
+
+// The same field, standing still, batched in each of SpriteSystem's
+// layouts in turn.  Only the batching itself is timed:  the field is
+// transformed once up front, and then SpriteSystem's update is called on
+// its own each frame.
+int RunSpriteLayoutScenario(const BenchOptions& options) {
+  struct Layout {
+    SpriteBatchMode mode;
+    const char* name;
+  };
+  static const Layout kLayouts[] = {
+    { kSpriteTriangles, "triangles" },
+    { kSpriteIndexedQuads, "indexed quads" },
+    { kSpriteInstanced, "instanced" },
+  };
+  std::srand(options.seed);
+
+  CommonSystem common_system;
+  TransformSystem transform_system;
+  SpriteSystem sprite_system;
+  PhysicsSystem physics_system;
+  ParticleSystem particle_system;
+  corgi::EntityManager entity_manager;
+
+  sprite_system.set_headless(true);
+  entity_manager.RegisterSystem(&common_system);
+  entity_manager.RegisterSystem(&transform_system);
+  entity_manager.RegisterSystem(&sprite_system);
+  entity_manager.RegisterSystem(&physics_system);
+  entity_manager.RegisterSystem(&particle_system);
+  entity_manager.set_max_worker_threads(options.worker_threads);
+  entity_manager.FinalizeSystemList();
+
+  for (int i = 0; i < options.sprites; i++) {
+    SpawnSprite(&entity_manager);
+  }
+  entity_manager.UpdateSystems(options.delta_time);
+
+  printf("scenario: sprite_layouts\n");
+  printf("  threads %d  seed %u  warmup %d\n",
+      entity_manager.job_pool()->thread_count() - 1, options.seed,
+      options.warmup_frames);
+
+  for (size_t i = 0; i < sizeof(kLayouts) / sizeof(kLayouts[0]); i++) {
+    sprite_system.set_batch_mode(kLayouts[i].mode);
+    FrameStats stats;
+    int total_frames = options.warmup_frames + options.frames;
+    for (int frame = 0; frame < total_frames; frame++) {
+      double start = BenchNowMs();
+      sprite_system.UpdateAllEntities(options.delta_time);
+      double elapsed = BenchNowMs() - start;
+      if (frame >= options.warmup_frames) {
+        stats.AddSample(elapsed, sprite_system.sprite_count());
+      }
+    }
+
+    printf("  %s:  %d bytes/sprite, %.1f KB/frame\n", kLayouts[i].name,
+        static_cast<int>(sprite_system.bytes_per_sprite()),
+        sprite_system.vertex_bytes() / 1024.0);
+    stats.PrintReport("fill");
+  }
+  return 0;
+}